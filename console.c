@@ -4,11 +4,13 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "console.h"
@@ -18,6 +20,10 @@
 /* Some global values */
 int simulation = 0;
 int show_entropy = 0;
+/* Record how long each command takes, for 'stats' */
+static int latency_stats = 1;
+/* Called after every command, e.g. to record it to a file */
+static cmd_hook_t cmd_hook = NULL;
 static cmd_element_t *cmd_list = NULL;
 static param_element_t *param_list = NULL;
 static bool block_flag = false;
@@ -33,14 +39,31 @@ static double first_time, last_time;
  * Must create stack of buffers to handle I/O with nested source commands.
  */
 
-#define RIO_BUFSIZE 8192
+#define RIO_BUFSIZE 8192 /* Longest line */
+#define RIO_BLOCKSIZE (64 * 1024)
+
+/* Compiled command file, see compile_file().  Each instruction is a command
+ * line already split into words: its word count, then the id of each word
+ * in a table of interned strings, all as LEB128 varints.
+ */
+typedef struct {
+    char *blob; /* File contents, holding the strings */
+    size_t blob_size;
+    char **strings; /* Interned strings, by id */
+    uint32_t nstrings;
+    cmd_element_t **cmds; /* Command named by each string, if any */
+    const uint8_t *code;  /* Within blob */
+    size_t code_size;
+} program_t;
 
 typedef struct __rio {
-    int fd;                /* File descriptor */
-    int count;             /* Unread bytes in internal buffer */
-    char *bufptr;          /* Next unread byte in internal buffer */
-    char buf[RIO_BUFSIZE]; /* Internal buffer */
-    struct __rio *prev;    /* Next element in stack */
+    int fd;                  /* File descriptor */
+    int count;               /* Unread bytes in internal buffer */
+    char *bufptr;            /* Next unread byte in internal buffer */
+    char buf[RIO_BLOCKSIZE]; /* Internal buffer */
+    program_t *prog;         /* Compiled file being run, or NULL */
+    size_t pc;               /* Offset of the next instruction of prog */
+    struct __rio *prev;      /* Next element in stack */
 } rio_t;
 
 static rio_t *buf_stack;
@@ -55,6 +78,8 @@ static int err_cnt = 0;
 static int echo = 0;
 
 static bool quit_flag = false;
+static bool batch_mode = false;
+static size_t cmd_count = 0; /* Commands run, for the batch summary */
 static char *prompt = "cmd> ";
 static bool has_infile = false;
 
@@ -69,9 +94,58 @@ static void init_in();
 
 static bool push_file(char *fname);
 static void pop_file();
+static char *readline();
+static bool do_repeat(int argc, char *argv[]);
+static bool block_record(int argc, char *argv[]);
 
 static bool interpret_cmda(int argc, char *argv[]);
 
+/* Commands and parameters are also indexed by name in open-addressing hash
+ * tables with linear probing, so that finding one by name does not walk the
+ * alphabetical lists.
+ */
+#define NAME_TABLE_SIZE 256 /* Must be a power of 2 */
+
+static cmd_element_t *cmd_table[NAME_TABLE_SIZE];
+static param_element_t *param_table[NAME_TABLE_SIZE];
+
+/* 32-bit FNV-1a */
+static uint32_t name_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Table slot holding the command called name, or the empty slot where it
+ * belongs.  NULL if the table is full.
+ */
+static cmd_element_t **cmd_slot(const char *name)
+{
+    uint32_t h = name_hash(name);
+    for (size_t i = 0; i < NAME_TABLE_SIZE; i++) {
+        cmd_element_t **slot = &cmd_table[(h + i) & (NAME_TABLE_SIZE - 1)];
+        if (!*slot || strcmp((*slot)->name, name) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+static param_element_t **param_slot(const char *name)
+{
+    uint32_t h = name_hash(name);
+    for (size_t i = 0; i < NAME_TABLE_SIZE; i++) {
+        param_element_t **slot =
+            &param_table[(h + i) & (NAME_TABLE_SIZE - 1)];
+        if (!*slot || strcmp((*slot)->name, name) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
 {
@@ -87,8 +161,14 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->operation = operation;
     cmd->summary = summary;
     cmd->param = param;
+    cmd->latency = NULL;
     cmd->next = next_cmd;
     *last_loc = cmd;
+
+    cmd_element_t **slot = cmd_slot(name);
+    if (!slot)
+        report_event(MSG_FATAL, "Too many commands");
+    *slot = cmd;
 }
 
 /* Add a new parameter */
@@ -109,22 +189,37 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
+
+    param_element_t **slot = param_slot(name);
+    if (!slot)
+        report_event(MSG_FATAL, "Too many parameters");
+    *slot = param;
 }
 
-/* Parse a string into a command line */
+/* Arguments of the command being interpreted, reused for every command so
+ * that parsing a line allocates nothing.  A line of MAX_CMDLINE characters
+ * holds at most MAX_CMDLINE / 2 words.
+ */
+#define MAX_CMDLINE RIO_BUFSIZE
+
+static char arg_buf[MAX_CMDLINE];
+static char *arg_vec[MAX_CMDLINE / 2];
+
+/* Parse a string into a command line.  Returns NULL if it is too long */
 static char **parse_args(char *line, int *argcp)
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
     size_t len = strlen(line);
+    if (len >= MAX_CMDLINE) {
+        report(1, "Command line too long (%lu characters, limit %d)", len,
+               MAX_CMDLINE - 1);
+        return NULL;
+    }
 
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
-
+    /* Copy into buffer with each word null-terminated, recording where each
+     * word starts
+     */
     char *src = line;
-    char *dst = buf;
+    char *dst = arg_buf;
     bool skipping = true;
     int c;
     int argc = 0;
@@ -138,7 +233,7 @@ static char **parse_args(char *line, int *argcp)
         } else {
             if (skipping) {
                 /* Hit start of new word */
-                argc++;
+                arg_vec[argc++] = dst;
                 skipping = false;
             }
             *dst++ = c;
@@ -147,17 +242,8 @@ static char **parse_args(char *line, int *argcp)
     /* Let the last substring is null-terminated */
     *dst++ = '\0';
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
-    }
-
-    free_block(buf, len + 1);
     *argcp = argc;
-    return argv;
+    return arg_vec;
 }
 
 /* Handles forced console termination for record_error and do_quit */
@@ -168,6 +254,8 @@ static bool force_quit(int argc, char *argv[])
     while (c) {
         cmd_element_t *ele = c;
         c = c->next;
+        if (ele->latency)
+            free_block(ele->latency, sizeof(histogram_t));
         free_block(ele, sizeof(cmd_element_t));
     }
 
@@ -177,6 +265,8 @@ static bool force_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_element_t));
     }
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
 
     while (buf_stack)
         pop_file();
@@ -200,18 +290,35 @@ static void record_error()
     }
 }
 
-/* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+/* Run next_cmd, the command named argv[0] or NULL if there is none */
+static bool run_cmd(cmd_element_t *next_cmd, int argc, char *argv[])
 {
-    if (argc == 0)
-        return true;
-    /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
+    cmd_count++;
     if (next_cmd) {
+        struct timespec start, end;
+        /* A command installing or removing the hook is not passed to it */
+        cmd_hook_t hook = cmd_hook;
+        bool timed = latency_stats || hook;
+        if (timed)
+            clock_gettime(CLOCK_MONOTONIC, &start);
         ok = next_cmd->operation(argc, argv);
+        /* Commands are all gone once quit has run */
+        if (timed && !quit_flag) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            uint64_t ns = (end.tv_sec - start.tv_sec) * 1000000000LL +
+                          (end.tv_nsec - start.tv_nsec);
+            if (latency_stats) {
+                if (!next_cmd->latency) {
+                    next_cmd->latency =
+                        malloc_or_fail(sizeof(histogram_t), "run_cmd");
+                    hist_init(next_cmd->latency);
+                }
+                hist_record(next_cmd->latency, ns);
+            }
+            if (hook)
+                hook(argc, argv, ns, ok);
+        }
         if (!ok)
             record_error();
     } else {
@@ -223,6 +330,16 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
+/* Execute a command that has already been split into arguments */
+static bool interpret_cmda(int argc, char *argv[])
+{
+    if (argc == 0)
+        return true;
+    /* Try to find matching command */
+    cmd_element_t **slot = cmd_slot(argv[0]);
+    return run_cmd(slot ? *slot : NULL, argc, argv);
+}
+
 /* Execute a command from a command line */
 static bool interpret_cmd(char *cmdline)
 {
@@ -231,12 +348,13 @@ static bool interpret_cmd(char *cmdline)
 
     int argc;
     char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
-
-    return ok;
+    if (!argv) {
+        record_error();
+        return false;
+    }
+    if (block_record(argc, argv))
+        return true;
+    return interpret_cmda(argc, argv);
 }
 
 /* Set function to be executed as part of program exit */
@@ -248,6 +366,17 @@ void add_quit_helper(cmd_func_t qf)
         report_event(MSG_FATAL, "Exceeded limit on quit helpers");
 }
 
+/* Turn batch mode on/off: read standard input like a command file */
+void set_batch(bool on)
+{
+    batch_mode = on;
+}
+
+void set_cmd_hook(cmd_hook_t hook)
+{
+    cmd_hook = hook;
+}
+
 /* Turn echoing on/off */
 void set_echo(bool on)
 {
@@ -279,6 +408,32 @@ static bool do_help(int argc, char *argv[])
     return true;
 }
 
+static bool do_stats(int argc, char *argv[])
+{
+    bool reset = argc == 2 && strcmp(argv[1], "reset") == 0;
+    if (argc > 2 || (argc == 2 && !reset)) {
+        report(1, "Use 'stats' or 'stats reset'");
+        return false;
+    }
+
+    if (!reset)
+        report(1, "  %-12s%10s%10s%10s%10s%10s%10s", "Command (ns)", "count",
+               "mean", "p50", "p99", "p99.9", "max");
+    for (cmd_element_t *clist = cmd_list; clist; clist = clist->next) {
+        histogram_t *h = clist->latency;
+        if (!h || !h->count)
+            continue;
+        if (reset) {
+            hist_init(h);
+            continue;
+        }
+        report(1, "  %-12s%10lu%10lu%10lu%10lu%10lu%10lu", clist->name,
+               h->count, h->sum / h->count, hist_percentile(h, 0.5),
+               hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max);
+    }
+    return true;
+}
+
 static bool do_comment_cmd(int argc, char *argv[])
 {
     if (echo)
@@ -321,7 +476,6 @@ static bool do_option(int argc, char *argv[])
     for (int i = 1; i < argc; i++) {
         char *name = argv[i];
         int value = 0;
-        bool found = false;
         /* Get value from next argument */
         if (i + 1 >= argc) {
             report(1, "No value given for parameter %s", name);
@@ -330,23 +484,18 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
-        }
+        /* Find parameter in table */
+        param_element_t **slot = param_slot(name);
+        param_element_t *plist = slot ? *slot : NULL;
         /* Didn't find parameter */
-        if (!found) {
+        if (!plist) {
             report(1, "Unknown parameter '%s'", name);
             return false;
         }
+        int oldval = *plist->valp;
+        *plist->valp = value;
+        if (plist->setter)
+            plist->setter(oldval);
     }
 
     return true;
@@ -430,6 +579,8 @@ void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
     err_cnt = 0;
     quit_flag = false;
 
@@ -442,18 +593,589 @@ void init_cmd()
     ADD_COMMAND(log, "Copy output to file", "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
     ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
+    ADD_COMMAND(stats,
+                "Show latency of each command run so far, or clear it",
+                "[reset]");
+    ADD_COMMAND(repeat,
+                "Run a command N times, or with '{' the commands up to a "
+                "line '}'. $i, $j, $k count the iterations of nested loops",
+                "N cmd arg ... | N {");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
+    add_param("latency", &latency_stats,
+              "Record the latency of every command for 'stats'", NULL);
 
     init_in();
     init_time(&last_time);
     first_time = last_time;
 }
 
+/* Compiled command files start with this, then three little-endian 32-bit
+ * counts: strings, bytes of strings, and bytes of code.  The NUL-terminated
+ * strings follow in id order, then the code.
+ */
+static const char program_magic[8] = {'Q', 'T', 'E', 'S', 'T', 'B', 'C', '1'};
+#define PROGRAM_HEADER (sizeof(program_magic) + 3 * sizeof(uint32_t))
+
+static uint32_t get_u32(const char *p)
+{
+    const uint8_t *b = (const uint8_t *) p;
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t) b[3] << 24;
+}
+
+/* Decode the varint at code[*pc], not reading past size */
+static bool get_varint(const uint8_t *code,
+                       size_t size,
+                       size_t *pc,
+                       uint32_t *x)
+{
+    *x = 0;
+    for (int shift = 0; shift < 35 && *pc < size; shift += 7) {
+        uint8_t b = code[(*pc)++];
+        *x |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void free_program(program_t *prog)
+{
+    if (prog->blob)
+        free_block(prog->blob, prog->blob_size);
+    if (prog->strings) {
+        free_array(prog->strings, prog->nstrings, sizeof(char *));
+        free_array(prog->cmds, prog->nstrings, sizeof(cmd_element_t *));
+    }
+    free_block(prog, sizeof(program_t));
+}
+
+/* Check that every instruction of prog names strings it has and fits the
+ * argument array
+ */
+static bool check_program(const program_t *prog)
+{
+    for (size_t pc = 0; pc < prog->code_size;) {
+        uint32_t argc, id;
+        if (!get_varint(prog->code, prog->code_size, &pc, &argc) ||
+            argc == 0 || argc > MAX_CMDLINE / 2)
+            return false;
+        for (uint32_t i = 0; i < argc; i++) {
+            if (!get_varint(prog->code, prog->code_size, &pc, &id) ||
+                id >= prog->nstrings)
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Load fd if it holds a compiled command file.  *progp is left NULL for a
+ * plain one.  Returns false if a compiled file is unreadable or corrupt.
+ */
+static bool load_program(int fd, program_t **progp)
+{
+    char magic[sizeof(program_magic)];
+    *progp = NULL;
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(magic, program_magic, sizeof(magic)) != 0)
+        return true;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < PROGRAM_HEADER)
+        return false;
+
+    program_t *prog = calloc_or_fail(1, sizeof(program_t), "load_program");
+    prog->blob_size = st.st_size;
+    prog->blob = malloc_or_fail(prog->blob_size, "load_program");
+    for (size_t done = 0; done < prog->blob_size;) {
+        ssize_t n =
+            pread(fd, prog->blob + done, prog->blob_size - done, done);
+        if (n <= 0) {
+            free_program(prog);
+            return false;
+        }
+        done += n;
+    }
+
+    const char *p = prog->blob + sizeof(program_magic);
+    uint32_t nstrings = get_u32(p);
+    uint32_t strings_size = get_u32(p + 4);
+    uint32_t code_size = get_u32(p + 8);
+    size_t body = prog->blob_size - PROGRAM_HEADER;
+    /* Every string takes at least its NUL */
+    if (strings_size > body || body - strings_size != code_size ||
+        nstrings > strings_size) {
+        free_program(prog);
+        return false;
+    }
+
+    if (nstrings) {
+        char *str = prog->blob + PROGRAM_HEADER;
+        char *end = str + strings_size;
+        prog->nstrings = nstrings;
+        prog->strings =
+            calloc_or_fail(nstrings, sizeof(char *), "load_program");
+        prog->cmds =
+            calloc_or_fail(nstrings, sizeof(cmd_element_t *), "load_program");
+        for (uint32_t id = 0; id < nstrings; id++) {
+            char *nul = str < end ? memchr(str, '\0', end - str) : NULL;
+            if (!nul) {
+                free_program(prog);
+                return false;
+            }
+            cmd_element_t **slot = cmd_slot(str);
+            prog->strings[id] = str;
+            prog->cmds[id] = slot ? *slot : NULL;
+            str = nul + 1;
+        }
+    }
+
+    prog->code = (uint8_t *) prog->blob + PROGRAM_HEADER + strings_size;
+    prog->code_size = code_size;
+    if (!check_program(prog)) {
+        free_program(prog);
+        return false;
+    }
+    *progp = prog;
+    return true;
+}
+
+/* Run the next instruction of the compiled file on top of the stack.  The
+ * words are handed to the command in place: commands must not modify
+ * their arguments.
+ */
+static void step_program()
+{
+    rio_t *rio = buf_stack;
+    program_t *prog = rio->prog;
+    if (rio->pc >= prog->code_size) {
+        pop_file();
+        return;
+    }
+
+    /* Already checked by load_program() */
+    uint32_t argc, id, cmd_id = 0;
+    get_varint(prog->code, prog->code_size, &rio->pc, &argc);
+    for (uint32_t i = 0; i < argc; i++) {
+        get_varint(prog->code, prog->code_size, &rio->pc, &id);
+        arg_vec[i] = prog->strings[id];
+        if (i == 0)
+            cmd_id = id;
+    }
+
+    if (echo) {
+        report_noreturn(1, prompt);
+        for (uint32_t i = 0; i < argc - 1; i++)
+            report_noreturn(1, "%s ", arg_vec[i]);
+        report(1, "%s", arg_vec[argc - 1]);
+    }
+
+    if (!quit_flag && !block_record(argc, arg_vec))
+        run_cmd(prog->cmds[cmd_id], argc, arg_vec);
+}
+
+/* Growable byte array of the compiler */
+typedef struct {
+    char *data;
+    size_t len, size;
+} bytes_t;
+
+static void bytes_append(bytes_t *b, const void *src, size_t len)
+{
+    if (b->len + len > b->size) {
+        size_t size = b->size ? b->size : 4096;
+        while (size < b->len + len)
+            size *= 2;
+        char *data = malloc_or_fail(size, "compile_file");
+        if (b->data) {
+            memcpy(data, b->data, b->len);
+            free_block(b->data, b->size);
+        }
+        b->data = data;
+        b->size = size;
+    }
+    memcpy(b->data + b->len, src, len);
+    b->len += len;
+}
+
+static void bytes_append_u32(bytes_t *b, uint32_t x)
+{
+    uint8_t le[4] = {x, x >> 8, x >> 16, x >> 24};
+    bytes_append(b, le, sizeof(le));
+}
+
+static void bytes_append_varint(bytes_t *b, uint32_t x)
+{
+    uint8_t v[5];
+    size_t len = 0;
+    do {
+        v[len++] = (x & 0x7f) | (x > 0x7f ? 0x80 : 0);
+        x >>= 7;
+    } while (x);
+    bytes_append(b, v, len);
+}
+
+static void bytes_free(bytes_t *b)
+{
+    if (b->data)
+        free_block(b->data, b->size);
+}
+
+/* Strings of the program being compiled, each stored once */
+typedef struct {
+    bytes_t strings; /* NUL-terminated, in id order */
+    uint32_t *offsets;
+    uint32_t nstrings;
+    uint32_t *slots; /* Open-addressing table of id + 1; 0 when free */
+    size_t nslots;   /* Power of 2, at least twice nstrings */
+} intern_t;
+
+static void intern_grow(intern_t *in)
+{
+    size_t nslots = in->nslots ? 2 * in->nslots : 256;
+    uint32_t *slots = calloc_or_fail(nslots, sizeof(uint32_t), "intern");
+    uint32_t *offsets = calloc_or_fail(nslots / 2, sizeof(uint32_t), "intern");
+    for (uint32_t id = 0; id < in->nstrings; id++) {
+        offsets[id] = in->offsets[id];
+        size_t i = name_hash(in->strings.data + offsets[id]);
+        while (slots[i & (nslots - 1)])
+            i++;
+        slots[i & (nslots - 1)] = id + 1;
+    }
+    if (in->slots) {
+        free_array(in->slots, in->nslots, sizeof(uint32_t));
+        free_array(in->offsets, in->nslots / 2, sizeof(uint32_t));
+    }
+    in->slots = slots;
+    in->offsets = offsets;
+    in->nslots = nslots;
+}
+
+/* Id of string s, adding it if it is new */
+static uint32_t intern(intern_t *in, const char *s)
+{
+    if (2 * (in->nstrings + 1) > in->nslots)
+        intern_grow(in);
+
+    size_t i = name_hash(s);
+    for (;; i++) {
+        uint32_t e = in->slots[i & (in->nslots - 1)];
+        if (!e)
+            break;
+        if (strcmp(in->strings.data + in->offsets[e - 1], s) == 0)
+            return e - 1;
+    }
+
+    uint32_t id = in->nstrings++;
+    in->offsets[id] = in->strings.len;
+    bytes_append(&in->strings, s, strlen(s) + 1);
+    in->slots[i & (in->nslots - 1)] = id + 1;
+    return id;
+}
+
+static void intern_free(intern_t *in)
+{
+    bytes_free(&in->strings);
+    if (in->slots) {
+        free_array(in->slots, in->nslots, sizeof(uint32_t));
+        free_array(in->offsets, in->nslots / 2, sizeof(uint32_t));
+    }
+}
+
+bool compile_file(char *infile_name, char *outfile_name)
+{
+    if (!push_file(infile_name)) {
+        report(1, "ERROR: Could not open source file '%s'", infile_name);
+        return false;
+    }
+    if (buf_stack->prog) {
+        report(1, "ERROR: '%s' is already compiled", infile_name);
+        pop_file();
+        return false;
+    }
+
+    intern_t in = {0};
+    bytes_t code = {0};
+    bool ok = true;
+    char *line;
+    while ((line = readline())) {
+        int argc;
+        char **argv = parse_args(line, &argc);
+        if (!argv) {
+            ok = false;
+            continue;
+        }
+        if (argc == 0)
+            continue;
+        bytes_append_varint(&code, argc);
+        for (int i = 0; i < argc; i++)
+            bytes_append_varint(&code, intern(&in, argv[i]));
+    }
+
+    FILE *out = ok ? fopen(outfile_name, "wb") : NULL;
+    if (ok && !out) {
+        report(1, "ERROR: Could not open '%s' for writing", outfile_name);
+        ok = false;
+    }
+    if (out) {
+        bytes_t header = {0};
+        bytes_append(&header, program_magic, sizeof(program_magic));
+        bytes_append_u32(&header, in.nstrings);
+        bytes_append_u32(&header, in.strings.len);
+        bytes_append_u32(&header, code.len);
+        ok = fwrite(header.data, 1, header.len, out) == header.len &&
+             fwrite(in.strings.data, 1, in.strings.len, out) ==
+                 in.strings.len &&
+             fwrite(code.data, 1, code.len, out) == code.len;
+        ok = fclose(out) == 0 && ok;
+        if (!ok)
+            report(1, "ERROR: Could not write '%s'", outfile_name);
+        bytes_free(&header);
+    }
+
+    intern_free(&in);
+    bytes_free(&code);
+    return ok;
+}
+
+/* Loops of the command language.  'repeat N cmd arg ...' runs one command N
+ * times.  'repeat N {' records the commands of the following lines, up to
+ * the matching '}', and then runs them N times from the recorded block, in
+ * the compiled form.  Blocks may nest.  In the arguments of a repeated
+ * command, $i stands for the iteration of the innermost loop, counted from
+ * 0, and $j and $k for those of the enclosing ones.
+ */
+#define MAX_REPEAT_DEPTH 16
+
+static uint32_t repeat_counters[MAX_REPEAT_DEPTH];
+static int repeat_depth = 0;
+
+/* Block being recorded */
+static struct {
+    int depth;    /* Open blocks, 0 when not recording */
+    rio_t *rio;   /* Input the block is read from */
+    int count;    /* Times to run it */
+    intern_t in;  /* Its words */
+    bytes_t code; /* and instructions, as in a compiled file */
+} block;
+
+static bool is_block_start(int argc, char *argv[])
+{
+    return argc == 3 && strcmp(argv[0], "repeat") == 0 &&
+           strcmp(argv[2], "{") == 0;
+}
+
+static bool is_block_end(int argc, char *argv[])
+{
+    return argc == 1 && strcmp(argv[0], "}") == 0;
+}
+
+static bool get_count(char *s, int *count)
+{
+    if (!get_int(s, count) || *count < 0) {
+        report(1, "Invalid repeat count '%s'", s);
+        return false;
+    }
+    return true;
+}
+
+/* Decode the instruction at *pc of prog into argv, with loop counters
+ * substituted into its arguments in text.  Returns its word count, 0 if
+ * the substituted words do not fit.
+ */
+static int decode_instruction(const program_t *prog,
+                              size_t *pc,
+                              char *argv[],
+                              char *text,
+                              uint32_t *cmd_id)
+{
+    uint32_t argc, id;
+    size_t used = 0;
+    get_varint(prog->code, prog->code_size, pc, &argc);
+    for (uint32_t i = 0; i < argc; i++) {
+        get_varint(prog->code, prog->code_size, pc, &id);
+        char *word = prog->strings[id];
+        argv[i] = word;
+        if (i == 0) {
+            *cmd_id = id;
+            continue;
+        }
+        if (!strchr(word, '$'))
+            continue;
+
+        argv[i] = text + used;
+        for (char *c = word; *c; c++) {
+            int level = -1;
+            if (c[0] == '$' && c[1] >= 'i' && c[1] <= 'k')
+                level = repeat_depth - 1 - (c[1] - 'i');
+            int len = level >= 0
+                          ? snprintf(text + used, MAX_CMDLINE - used, "%u",
+                                     repeat_counters[level])
+                          : snprintf(text + used, MAX_CMDLINE - used, "%c",
+                                     *c);
+            if (len < 0 || used + len >= MAX_CMDLINE)
+                return 0;
+            used += len;
+            if (level >= 0)
+                c++;
+        }
+        used++;
+    }
+    return argc;
+}
+
+/* Offset of the '}' closing the block whose body starts at pc */
+static size_t find_block_end(const program_t *prog, size_t pc, size_t end)
+{
+    int depth = 0;
+    while (pc < end) {
+        size_t ins = pc;
+        uint32_t argc, first = 0, last = 0;
+        get_varint(prog->code, prog->code_size, &pc, &argc);
+        for (uint32_t i = 0; i < argc; i++) {
+            get_varint(prog->code, prog->code_size, &pc, &last);
+            if (i == 0)
+                first = last;
+        }
+        char *words[3] = {prog->strings[first], NULL, prog->strings[last]};
+        if (is_block_start(argc, words))
+            depth++;
+        else if (is_block_end(argc, words) && depth-- == 0)
+            return ins;
+    }
+    return end;
+}
+
+/* Run the instructions of prog between offsets start and end count times */
+static void run_block(const program_t *prog,
+                      size_t start,
+                      size_t end,
+                      int count)
+{
+    if (repeat_depth == MAX_REPEAT_DEPTH) {
+        report(1, "Repeat blocks nested more than %d deep", MAX_REPEAT_DEPTH);
+        record_error();
+        return;
+    }
+
+    char **argv =
+        malloc_or_fail(MAX_CMDLINE / 2 * sizeof(char *), "run_block");
+    char *text = malloc_or_fail(MAX_CMDLINE, "run_block");
+    int level = repeat_depth++;
+    for (int it = 0; it < count && !quit_flag; it++) {
+        repeat_counters[level] = it;
+        for (size_t pc = start; pc < end && !quit_flag;) {
+            uint32_t cmd_id;
+            int argc = decode_instruction(prog, &pc, argv, text, &cmd_id);
+            if (argc == 0) {
+                report(1, "Command line too long");
+                record_error();
+            } else if (is_block_start(argc, argv)) {
+                /* Nested block: its body runs up to the matching '}' */
+                size_t body_end = find_block_end(prog, pc, end);
+                int n;
+                if (get_count(argv[1], &n))
+                    run_block(prog, pc, body_end, n);
+                else
+                    record_error();
+                pc = body_end;
+                decode_instruction(prog, &pc, argv, text, &cmd_id);
+            } else {
+                run_cmd(prog->cmds[cmd_id], argc, argv);
+            }
+        }
+    }
+    repeat_depth--;
+    free_array(argv, MAX_CMDLINE / 2, sizeof(char *));
+    free_block(text, MAX_CMDLINE);
+}
+
+static void record_instruction(intern_t *in,
+                               bytes_t *code,
+                               int argc,
+                               char *argv[])
+{
+    bytes_append_varint(code, argc);
+    for (int i = 0; i < argc; i++)
+        bytes_append_varint(code, intern(in, argv[i]));
+}
+
+/* Run the recorded instructions count times, then drop them */
+static void run_recorded(intern_t *in, bytes_t *code, int count)
+{
+    program_t prog = {0};
+    if (in->nstrings) {
+        prog.nstrings = in->nstrings;
+        prog.strings = calloc_or_fail(in->nstrings, sizeof(char *), "repeat");
+        prog.cmds =
+            calloc_or_fail(in->nstrings, sizeof(cmd_element_t *), "repeat");
+        for (uint32_t id = 0; id < in->nstrings; id++) {
+            prog.strings[id] = in->strings.data + in->offsets[id];
+            cmd_element_t **slot = cmd_slot(prog.strings[id]);
+            prog.cmds[id] = slot ? *slot : NULL;
+        }
+    }
+    prog.code = (uint8_t *) code->data;
+    prog.code_size = code->len;
+
+    run_block(&prog, 0, prog.code_size, count);
+
+    if (prog.strings) {
+        free_array(prog.strings, prog.nstrings, sizeof(char *));
+        free_array(prog.cmds, prog.nstrings, sizeof(cmd_element_t *));
+    }
+    intern_free(in);
+    bytes_free(code);
+    memset(in, 0, sizeof(*in));
+    memset(code, 0, sizeof(*code));
+}
+
+/* Take a command line into the block being recorded, if any.  Returns
+ * false when not recording.
+ */
+static bool block_record(int argc, char *argv[])
+{
+    if (!block.depth || argc == 0)
+        return block.depth > 0;
+
+    if (is_block_end(argc, argv) && --block.depth == 0) {
+        run_recorded(&block.in, &block.code, block.count);
+        return true;
+    }
+    if (is_block_start(argc, argv))
+        block.depth++;
+    record_instruction(&block.in, &block.code, argc, argv);
+    return true;
+}
+
+static bool do_repeat(int argc, char *argv[])
+{
+    int count;
+    if (argc < 3) {
+        report(1, "Use 'repeat N cmd arg ...' or 'repeat N {'");
+        return false;
+    }
+    if (!get_count(argv[1], &count))
+        return false;
+
+    if (is_block_start(argc, argv)) {
+        block.depth = 1;
+        block.rio = buf_stack;
+        block.count = count;
+        return true;
+    }
+
+    intern_t in = {0};
+    bytes_t code = {0};
+    record_instruction(&in, &code, argc - 2, argv + 2);
+    run_recorded(&in, &code, count);
+    return true;
+}
+
 /* Create new buffer for named file.
  * Name == NULL for stdin.
  * Return true if successful.
@@ -468,10 +1190,19 @@ static bool push_file(char *fname)
     if (fd > fd_max)
         fd_max = fd;
 
+    program_t *prog = NULL;
+    if (fname && !load_program(fd, &prog)) {
+        report(1, "ERROR: Corrupt compiled file '%s'", fname);
+        close(fd);
+        return false;
+    }
+
     rio_t *rnew = malloc_or_fail(sizeof(rio_t), "push_file");
     rnew->fd = fd;
     rnew->count = 0;
     rnew->bufptr = rnew->buf;
+    rnew->prog = prog;
+    rnew->pc = 0;
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
@@ -484,6 +1215,16 @@ static void pop_file()
     if (buf_stack) {
         rio_t *rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (block.depth && block.rio == rsave) {
+            /* Input ended inside a repeat block: drop it */
+            report(1, "Missing '}' at end of repeat block");
+            intern_free(&block.in);
+            bytes_free(&block.code);
+            memset(&block, 0, sizeof(block));
+            err_cnt++;
+        }
+        if (rsave->prog)
+            free_program(rsave->prog);
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -495,60 +1236,71 @@ static void init_in()
     buf_stack = NULL;
 }
 
-/* Read command from input file.
+/* Read a line from input file, without its newline.
+ * A line that lies within the block buffer is terminated and returned in
+ * place; only one spanning two blocks is copied into linebuf.  Lines longer
+ * than RIO_BUFSIZE - 2 characters are split.
  * When hit EOF, close that file and return NULL
  */
 static char *readline()
 {
-    char c;
-    char *lptr = linebuf;
+    size_t len = 0; /* Characters of the line gathered in linebuf */
+    char *line = NULL;
 
     if (!buf_stack)
         return NULL;
 
-    for (int cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
+    while (!line) {
         if (buf_stack->count <= 0) {
             /* Need to read from input file */
-            buf_stack->count = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
+            buf_stack->count =
+                read(buf_stack->fd, buf_stack->buf, RIO_BLOCKSIZE);
             buf_stack->bufptr = buf_stack->buf;
             if (buf_stack->count <= 0) {
                 /* Encountered EOF */
                 pop_file();
-                if (cnt > 0) {
-                    /* Last line of file did not terminate with newline. */
-                    /*  Terminate line & return it */
-                    *lptr++ = '\n';
-                    *lptr++ = '\0';
-                    if (echo) {
-                        report_noreturn(1, prompt);
-                        report_noreturn(1, linebuf);
-                    }
-                    return linebuf;
-                }
-                return NULL;
+                if (len == 0)
+                    return NULL;
+                /* Last line of file did not terminate with newline. */
+                linebuf[len] = '\0';
+                line = linebuf;
+                break;
             }
         }
 
         /* Have text in buffer */
-        c = *buf_stack->bufptr++;
-        *lptr++ = c;
-        buf_stack->count--;
-        if (c == '\n')
+        char *start = buf_stack->bufptr;
+        size_t room = RIO_BUFSIZE - 2 - len;
+        size_t avail = (size_t) buf_stack->count;
+        if (avail > room)
+            avail = room;
+        char *nl = memchr(start, '\n', avail);
+        size_t take = nl ? (size_t) (nl - start) + 1 : avail;
+        buf_stack->bufptr += take;
+        buf_stack->count -= take;
+
+        if (nl && len == 0) {
+            *nl = '\0';
+            line = start;
             break;
-    }
+        }
 
-    if (c != '\n') {
-        /* Hit buffer limit.  Artificially terminate line */
-        *lptr++ = '\n';
+        size_t copy = nl ? take - 1 : take;
+        memcpy(linebuf + len, start, copy);
+        len += copy;
+        if (nl || len == RIO_BUFSIZE - 2) {
+            /* End of line, or hit buffer limit.  Terminate line */
+            linebuf[len] = '\0';
+            line = linebuf;
+        }
     }
-    *lptr++ = '\0';
 
     if (echo) {
         report_noreturn(1, prompt);
-        report_noreturn(1, linebuf);
+        report(1, "%s", line);
     }
 
-    return linebuf;
+    return line;
 }
 
 static bool cmd_done()
@@ -592,13 +1344,15 @@ static int cmd_select(int nfds,
         if (web_fd != -1)
             FD_SET(web_fd, readfds);
 
-        if (infd == STDIN_FILENO && prompt_flag) {
+        if (infd == STDIN_FILENO && prompt_flag && !batch_mode) {
             char *cmdline = linenoise(prompt);
             if (cmdline)
                 interpret_cmd(cmdline);
             fflush(stdout);
             prompt_flag = true;
-        } else if (infd != STDIN_FILENO) {
+        } else if (buf_stack->prog) {
+            step_program();
+        } else if (infd != STDIN_FILENO || batch_mode) {
             char *cmdline = readline();
             if (cmdline)
                 interpret_cmd(cmdline);
@@ -613,6 +1367,14 @@ bool finish_cmd()
     if (!quit_flag)
         ok = ok && do_quit(0, NULL);
     has_infile = false;
+
+    if (batch_mode) {
+        delta_time(&last_time);
+        double elapsed = last_time - first_time;
+        report(1, "Ran %lu commands in %.3f s (%.0f commands/s), %d errors",
+               cmd_count, elapsed, elapsed > 0 ? cmd_count / elapsed : 0.0,
+               err_cnt);
+    }
     return ok && err_cnt == 0;
 }
 
@@ -664,7 +1426,7 @@ bool run_console(char *infile_name)
         return false;
     }
 
-    if (!has_infile) {
+    if (!has_infile && !batch_mode) {
         char *cmdline;
         while (use_linenoise && (cmdline = linenoise(prompt))) {
             interpret_cmd(cmdline);
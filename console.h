@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <sys/select.h>
 
+#include "histogram.h"
 #include "linenoise.h"
 
 #define HISTORY_FILE ".cmd_history"
@@ -24,6 +25,7 @@ typedef struct __cmd_element {
     cmd_func_t operation;
     char *summary;
     char *param;
+    histogram_t *latency; /* Nanoseconds per run, allocated on first run */
     struct __cmd_element *next;
 } cmd_element_t;
 
@@ -59,6 +61,20 @@ void add_quit_helper(cmd_func_t qf);
 /* Turn echoing on/off */
 void set_echo(bool on);
 
+/* Turn batch mode on/off: standard input is read like a command file,
+ * without line editing or history, and finish_cmd() reports how many
+ * commands ran and how fast
+ */
+void set_batch(bool on);
+
+/* Function invoked after every command that was found, with its arguments,
+ * its duration in nanoseconds and whether it succeeded
+ */
+typedef void (*cmd_hook_t)(int argc, char *argv[], uint64_t ns, bool ok);
+
+/* Install hook, or remove it with NULL */
+void set_cmd_hook(cmd_hook_t hook);
+
 /* Complete command interpretation */
 
 /* Return true if no errors occurred */
@@ -68,6 +84,12 @@ bool finish_cmd();
  */
 bool run_console(char *infile_name);
 
+/* Translate the commands of infile_name into a compiled file, which runs
+ * like the original wherever a command file is accepted but without being
+ * parsed again.  Return true if successful.
+ */
+bool compile_file(char *infile_name, char *outfile_name);
+
 /* Callback function to complete command by linenoise */
 void completion(const char *buf, line_completions_t *lc);
 
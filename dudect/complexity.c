@@ -0,0 +1,422 @@
+/**
+ * Empirical complexity estimation.
+ *
+ * An operation is timed on inputs of 2^5, 2^6, ... elements until the time
+ * budget runs out.  Each size contributes the lower quartile of several
+ * samples: noise such as interrupts and page faults only ever adds time, so
+ * it stays out of the estimate.
+ *
+ * Classes are fitted on how the time grows from one size to the next:
+ * doubling n should multiply the time by f(2n) / f(n), e.g. 2 for O(n) and
+ * 4 for O(n^2).  The misfit of a class is the distance, in log2, of the
+ * observed ratios from its expected ones, taken at the lower third of all
+ * doublings.  This ignores the steps where the queue spills out of a cache
+ * level and every node suddenly costs more, which a fit over absolute
+ * times would read as an extra log factor.  The class with the smallest
+ * misfit wins; the confidence compares it to the runner-up.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+#include "random.h"
+
+#include "complexity.h"
+#include "cpucycles.h"
+
+#define MIN_LOG_SIZE 5
+#define MIN_POINTS 5
+
+/* Samples per size: at least MIN_SAMPLES, then more while cheap */
+#define MIN_SAMPLES 5
+#define MAX_SAMPLES 31
+#define SIZE_BUDGET_NS (50 * 1000 * 1000LL)
+#define TOTAL_BUDGET_NS (2 * 1000 * 1000 * 1000LL)
+
+/* Timer jitter; time differences below it carry no information */
+#define NOISE_NS 50.0
+
+/* How much worse, in log2 per doubling, a class may fit than the best one
+ * and still be accepted as expected
+ */
+#define TOLERANCE 0.1
+
+#define POOL_SIZE 4096
+#define KEY_LEN 8
+
+extern bool q_shuffle(struct list_head *head);
+
+static const char *class_names[COMPLEXITY_NR] = {
+    [COMPLEXITY_1] = "O(1)",         [COMPLEXITY_LOGN] = "O(log n)",
+    [COMPLEXITY_N] = "O(n)",         [COMPLEXITY_NLOGN] = "O(n log n)",
+    [COMPLEXITY_N2] = "O(n^2)",
+};
+
+static const char *class_keys[COMPLEXITY_NR] = {
+    [COMPLEXITY_1] = "1",         [COMPLEXITY_LOGN] = "logn",
+    [COMPLEXITY_N] = "n",         [COMPLEXITY_NLOGN] = "nlogn",
+    [COMPLEXITY_N2] = "n2",
+};
+
+const char *complexity_name(complexity_t c)
+{
+    return c < COMPLEXITY_NR ? class_names[c] : "unknown";
+}
+
+bool complexity_parse(const char *s, complexity_t *c)
+{
+    for (int i = 0; i < COMPLEXITY_NR; i++) {
+        if (!strcmp(s, class_keys[i]) || !strcmp(s, class_names[i])) {
+            *c = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static double growth(complexity_t c, double n)
+{
+    switch (c) {
+    case COMPLEXITY_LOGN:
+        return log2(n);
+    case COMPLEXITY_N:
+        return n;
+    case COMPLEXITY_NLOGN:
+        return n * log2(n);
+    case COMPLEXITY_N2:
+        return n * n;
+    default:
+        return 1;
+    }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Cost of the two clock reads around run(), subtracted from every sample */
+static int64_t clock_overhead(void)
+{
+    int64_t best = INT64_MAX;
+    for (int i = 0; i < 64; i++) {
+        int64_t before = cpucycles_monotonic();
+        int64_t after = cpucycles_monotonic();
+        if (after - before < best)
+            best = after - before;
+    }
+    return best;
+}
+
+static void fit(complexity_result_t *res)
+{
+    double misfit_best = INFINITY, misfit_next = INFINITY;
+    double dev[COMPLEXITY_MAX_POINTS];
+    size_t steps = res->points - 1;
+
+    for (int c = 0; c < COMPLEXITY_NR; c++) {
+        for (size_t i = 0; i < steps; i++) {
+            double seen =
+                log2((res->ns[i + 1] + NOISE_NS) / (res->ns[i] + NOISE_NS));
+            double want = log2(growth(c, res->n[i + 1]) / growth(c, res->n[i]));
+            dev[i] = (seen - want) * (seen - want);
+        }
+        qsort(dev, steps, sizeof(double), cmp_double);
+        res->misfit[c] = sqrt(dev[steps / 3]);
+
+        if (res->misfit[c] < misfit_best) {
+            misfit_next = misfit_best;
+            misfit_best = res->misfit[c];
+            res->best = c;
+        } else if (res->misfit[c] < misfit_next) {
+            misfit_next = res->misfit[c];
+        }
+    }
+    res->confidence = misfit_next > 0 ? 1 - misfit_best / misfit_next : 0;
+}
+
+bool complexity_within(const complexity_result_t *res, complexity_t expected)
+{
+    for (int c = COMPLEXITY_1; c <= expected; c++) {
+        if (res->misfit[c] <= res->misfit[res->best] + TOLERANCE)
+            return true;
+    }
+    return false;
+}
+
+/* Lower quartile time of one run() on an input of n elements, or -1 on
+ * failure
+ */
+static double sample(const complexity_op_t *op, size_t n, int64_t overhead)
+{
+    double samples[MAX_SAMPLES];
+    int64_t start = cpucycles_monotonic();
+    bool ready = false;
+    int cnt = 0;
+
+    while (cnt < MAX_SAMPLES) {
+        if (!ready && !op->setup(n))
+            return -1;
+        int64_t before = cpucycles_monotonic();
+        op->run();
+        int64_t after = cpucycles_monotonic();
+        samples[cnt++] = after - before - overhead;
+
+        ready = op->restore && op->restore();
+        if (!ready)
+            op->teardown();
+        if (cnt >= MIN_SAMPLES &&
+            cpucycles_monotonic() - start > SIZE_BUDGET_NS)
+            break;
+    }
+    if (ready)
+        op->teardown();
+
+    qsort(samples, cnt, sizeof(double), cmp_double);
+    return samples[cnt / 4] > 1 ? samples[cnt / 4] : 1;
+}
+
+bool complexity_estimate(const complexity_op_t *op, complexity_result_t *res)
+{
+    int64_t overhead = clock_overhead();
+    int64_t start = cpucycles_monotonic();
+
+    memset(res, 0, sizeof(*res));
+    for (int k = 0; k < COMPLEXITY_MAX_POINTS; k++) {
+        size_t n = (size_t) 1 << (MIN_LOG_SIZE + k);
+        int64_t size_start = cpucycles_monotonic();
+
+        double t = sample(op, n, overhead);
+        if (t < 0)
+            return false;
+        res->n[res->points] = n;
+        res->ns[res->points] = t;
+        res->points++;
+
+        /* Stop before a size that, even if the operation is quadratic,
+         * cannot be sampled within what is left of the budget.
+         */
+        int64_t now = cpucycles_monotonic();
+        if (now - start + 4 * (now - size_start) > TOTAL_BUDGET_NS)
+            break;
+    }
+
+    if (res->points < MIN_POINTS)
+        return false;
+    fit(res);
+    return true;
+}
+
+/* Queue operations.  Like the constant-time fixture, they work on a queue of
+ * their own so that the queues in qtest are left untouched.
+ */
+static struct list_head *l = NULL;
+static element_t *removed = NULL;
+static char pool[POOL_SIZE][KEY_LEN];
+static size_t pool_iter = 0;
+
+static char *next_key(void)
+{
+    pool_iter = (pool_iter + 1) % POOL_SIZE;
+    return pool[pool_iter];
+}
+
+static void teardown(void)
+{
+    q_free(l);
+    l = NULL;
+}
+
+static bool fill(size_t n, bool sorted)
+{
+    if (!pool[0][0]) {
+        randombytes((uint8_t *) pool, sizeof(pool));
+        for (size_t i = 0; i < POOL_SIZE; i++) {
+            for (size_t j = 0; j < KEY_LEN - 1; j++)
+                pool[i][j] = 'a' + (uint8_t) pool[i][j] % 26;
+            pool[i][KEY_LEN - 1] = '\0';
+        }
+    }
+
+    l = q_new();
+    if (!l)
+        return false;
+    for (size_t i = 0; i < n; i++) {
+        char key[24];
+        /* Ascending keys, each appearing twice, for q_delete_dup */
+        if (sorted)
+            snprintf(key, sizeof(key), "%08lu", (unsigned long) i / 2);
+        if (!q_insert_tail(l, sorted ? key : next_key())) {
+            teardown();
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool setup_random(size_t n)
+{
+    return fill(n, false);
+}
+
+static bool setup_sorted(size_t n)
+{
+    return fill(n, true);
+}
+
+static bool restore_nothing(void)
+{
+    return true;
+}
+
+static void run_ih(void)
+{
+    q_insert_head(l, next_key());
+}
+
+static void run_it(void)
+{
+    q_insert_tail(l, next_key());
+}
+
+static bool restore_insert(void)
+{
+    element_t *e = q_remove_head(l, NULL, 0);
+    if (!e)
+        return false;
+    q_release_element(e);
+    return true;
+}
+
+static void run_rh(void)
+{
+    removed = q_remove_head(l, NULL, 0);
+}
+
+static void run_rt(void)
+{
+    removed = q_remove_tail(l, NULL, 0);
+}
+
+static bool restore_remove(void)
+{
+    if (!removed)
+        return false;
+    bool ok = q_insert_head(l, removed->value);
+    q_release_element(removed);
+    removed = NULL;
+    return ok;
+}
+
+static void run_size(void)
+{
+    q_size(l);
+}
+
+static void run_reverse(void)
+{
+    q_reverse(l);
+}
+
+static void run_reverseK(void)
+{
+    q_reverseK(l, 3);
+}
+
+static void run_swap(void)
+{
+    q_swap(l);
+}
+
+static void run_dm(void)
+{
+    q_delete_mid(l);
+}
+
+static bool restore_dm(void)
+{
+    return q_insert_head(l, next_key());
+}
+
+static void run_sort(void)
+{
+    q_sort(l, false);
+}
+
+static void run_dedup(void)
+{
+    q_delete_dup(l);
+}
+
+static void run_ascend(void)
+{
+    q_ascend(l);
+}
+
+static void run_descend(void)
+{
+    q_descend(l);
+}
+
+static void run_shuffle(void)
+{
+    q_shuffle(l);
+}
+
+static void run_free(void)
+{
+    q_free(l);
+    l = NULL;
+}
+
+static void teardown_freed(void)
+{
+    if (l)
+        teardown();
+}
+
+static const complexity_op_t queue_ops[] = {
+    {"ih", setup_random, run_ih, restore_insert, teardown},
+    {"it", setup_random, run_it, restore_insert, teardown},
+    {"rh", setup_random, run_rh, restore_remove, teardown},
+    {"rt", setup_random, run_rt, restore_remove, teardown},
+    {"size", setup_random, run_size, restore_nothing, teardown},
+    {"reverse", setup_random, run_reverse, restore_nothing, teardown},
+    {"reverseK", setup_random, run_reverseK, restore_nothing, teardown},
+    {"swap", setup_random, run_swap, restore_nothing, teardown},
+    {"dm", setup_random, run_dm, restore_dm, teardown},
+    {"shuffle", setup_random, run_shuffle, restore_nothing, teardown},
+    {"sort", setup_random, run_sort, NULL, teardown},
+    {"dedup", setup_sorted, run_dedup, NULL, teardown},
+    {"ascend", setup_random, run_ascend, NULL, teardown},
+    {"descend", setup_random, run_descend, NULL, teardown},
+    {"free", setup_random, run_free, NULL, teardown_freed},
+};
+
+#define NR_QUEUE_OPS (sizeof(queue_ops) / sizeof(queue_ops[0]))
+
+const complexity_op_t *complexity_find(const char *name)
+{
+    for (size_t i = 0; i < NR_QUEUE_OPS; i++) {
+        if (!strcmp(name, queue_ops[i].name))
+            return &queue_ops[i];
+    }
+    return NULL;
+}
+
+const char *complexity_ops(void)
+{
+    static char names[256];
+    if (!names[0]) {
+        size_t len = 0;
+        for (size_t i = 0; i < NR_QUEUE_OPS && len < sizeof(names); i++)
+            len += snprintf(names + len, sizeof(names) - len, "%s%s",
+                            i ? " " : "", queue_ops[i].name);
+    }
+    return names;
+}
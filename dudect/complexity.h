@@ -0,0 +1,61 @@
+#ifndef DUDECT_COMPLEXITY_H
+#define DUDECT_COMPLEXITY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Growth classes, from cheapest to most expensive */
+typedef enum {
+    COMPLEXITY_1,
+    COMPLEXITY_LOGN,
+    COMPLEXITY_N,
+    COMPLEXITY_NLOGN,
+    COMPLEXITY_N2,
+    COMPLEXITY_NR,
+} complexity_t;
+
+/* Operation under test.  setup() builds an input of n elements, run() is the
+ * only timed part, and restore() undoes run() so the same input can be timed
+ * again.  Without restore() the input is torn down and rebuilt per sample.
+ */
+typedef struct {
+    const char *name;
+    bool (*setup)(size_t n);
+    void (*run)(void);
+    bool (*restore)(void);
+    void (*teardown)(void);
+} complexity_op_t;
+
+/* Largest number of queue sizes probed: 2^5 up to 2^16 elements */
+#define COMPLEXITY_MAX_POINTS 12
+
+typedef struct {
+    size_t points;
+    size_t n[COMPLEXITY_MAX_POINTS];
+    double ns[COMPLEXITY_MAX_POINTS]; /* typical time of one run() */
+    double misfit[COMPLEXITY_NR];     /* log2 error per doubling */
+    complexity_t best;
+    double confidence; /* 1 - misfit(best) / misfit(runner-up) */
+} complexity_result_t;
+
+/* Time 'op' over geometrically growing sizes and fit every growth class.
+ * Returns false if setup failed or too few sizes fit in the time budget.
+ */
+bool complexity_estimate(const complexity_op_t *op, complexity_result_t *res);
+
+/* Whether the fit leaves 'expected', or a cheaper class, within tolerance of
+ * the best one.  Ratios of O(n) and O(n log n) differ by only a few percent
+ * per doubling, so a close runner-up is not treated as a regression.
+ */
+bool complexity_within(const complexity_result_t *res, complexity_t expected);
+
+/* Queue operation named like its qtest command, or NULL */
+const complexity_op_t *complexity_find(const char *name);
+
+/* Space-separated names of the queue operations that can be estimated */
+const char *complexity_ops(void);
+
+const char *complexity_name(complexity_t c);
+bool complexity_parse(const char *s, complexity_t *c);
+
+#endif
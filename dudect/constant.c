@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "constant.h"
@@ -8,41 +9,81 @@
 #include "random.h"
 
 /* Maintain a queue independent from the qtest since
- * we do not want the test to affect the original functionality
+ * we do not want the test to affect the original functionality.
+ * Each measuring thread has its own queue and inputs.
+ *
+ * Rather than building a queue for every measurement, the queue under test
+ * is cut from the front of a pool of POOL_SIZE elements built once, and
+ * spliced back once the measurement is done.  nodes[i] is the i-th element
+ * of the pool, so cutting off the first n elements takes O(1).
  */
-static struct list_head *l = NULL;
+static __thread struct list_head *l = NULL;
+static __thread struct list_head *pool = NULL;
+static __thread struct list_head **nodes = NULL;
 
-#define dut_new() ((void) (l = q_new()))
+/* Largest queue measured: 9999 random elements plus the fixture's extra */
+#define POOL_SIZE 10000
 
-#define dut_size(n)                                \
-    do {                                           \
-        for (int __iter = 0; __iter < n; ++__iter) \
-            q_size(l);                             \
-    } while (0)
+static void dut_free(void)
+{
+    q_free(l);
+    q_free(pool);
+    free(nodes);
+    l = pool = NULL;
+    nodes = NULL;
+}
+
+static bool dut_build(char *s)
+{
+    l = q_new();
+    pool = q_new();
+    nodes = malloc(POOL_SIZE * sizeof(*nodes));
+    if (!l || !pool || !nodes) {
+        dut_free();
+        return false;
+    }
+
+    for (size_t i = 0; i < POOL_SIZE; i++) {
+        if (!q_insert_tail(pool, s)) {
+            dut_free();
+            return false;
+        }
+    }
 
-#define dut_insert_head(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_head(l, s); \
-    } while (0)
+    struct list_head *node = pool->next;
+    for (size_t i = 0; i < POOL_SIZE; i++, node = node->next)
+        nodes[i] = node;
+    return true;
+}
 
-#define dut_insert_tail(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_tail(l, s); \
-    } while (0)
+/* Move the first n elements of the pool to the queue under test */
+static void dut_take(size_t n)
+{
+    if (n)
+        list_cut_position(l, pool, nodes[n - 1]);
+}
 
-#define dut_free() ((void) (q_free(l)))
+/* Give the elements back, in the order they were taken */
+static void dut_put(void)
+{
+    list_splice(l, pool);
+    INIT_LIST_HEAD(l);
+}
 
-static char random_string[N_MEASURES][8];
-static int random_string_iter = 0;
+static __thread char random_string[N_MEASURES][8];
+static __thread int random_string_iter = 0;
 
 /* Implement the necessary queue interface to simulation */
 void init_dut(void)
 {
     l = NULL;
+    pool = NULL;
+    nodes = NULL;
+}
+
+void free_dut(void)
+{
+    dut_free();
 }
 
 static char *get_random_string(void)
@@ -67,96 +108,124 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
     }
 }
 
+/* Timed operations.  Those that unlink an element return it, to be put
+ * back once the clock is stopped.
+ */
+static element_t *op_insert_head(char *s)
+{
+    q_insert_head(l, s);
+    return NULL;
+}
+
+static element_t *op_insert_tail(char *s)
+{
+    q_insert_tail(l, s);
+    return NULL;
+}
+
+static element_t *op_remove_head(char *s)
+{
+    return q_remove_head(l, NULL, 0);
+}
+
+static element_t *op_remove_tail(char *s)
+{
+    return q_remove_tail(l, NULL, 0);
+}
+
+/* Undo a timed operation on a queue of n elements, leaving nodes[0..n-1] in
+ * order again.  Returns false if that is not possible.
+ */
+static bool undo_insert_head(element_t *e, char *s, size_t n)
+{
+    if (list_empty(l) || l->next == nodes[0])
+        return false;
+    e = list_first_entry(l, element_t, list);
+    list_del(&e->list);
+    q_release_element(e);
+    return true;
+}
+
+static bool undo_insert_tail(element_t *e, char *s, size_t n)
+{
+    if (list_empty(l) || (n && l->prev == nodes[n - 1]))
+        return false;
+    e = list_last_entry(l, element_t, list);
+    list_del(&e->list);
+    q_release_element(e);
+    return true;
+}
+
+static bool undo_remove_head(element_t *e, char *s, size_t n)
+{
+    if (!e || &e->list != nodes[0])
+        return false;
+    list_add(&e->list, l);
+    return true;
+}
+
+static bool undo_remove_tail(element_t *e, char *s, size_t n)
+{
+    if (!e || &e->list != nodes[n - 1])
+        return false;
+    list_add_tail(&e->list, l);
+    return true;
+}
+
+/* How to measure each constant-time operation of DUT_FUNCS, the only ones
+ * test_const() runs: the queue holds the random number of elements drawn
+ * from the input plus 'extra', the timed call must change its size by
+ * 'delta', and 'undo' restores the queue afterwards.
+ */
+typedef struct {
+    element_t *(*op)(char *s);
+    bool (*undo)(element_t *e, char *s, size_t n);
+    int extra;
+    int delta;
+} dut_fixture_t;
+
+static const dut_fixture_t fixtures[] = {
+    [DUT(insert_head)] = {op_insert_head, undo_insert_head, 0, 1},
+    [DUT(insert_tail)] = {op_insert_tail, undo_insert_tail, 0, 1},
+    [DUT(remove_head)] = {op_remove_head, undo_remove_head, 1, -1},
+    [DUT(remove_tail)] = {op_remove_tail, undo_remove_tail, 1, -1},
+};
+
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
              int mode)
 {
-    assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
-           mode == DUT(remove_head) || mode == DUT(remove_tail));
-
-    switch (mode) {
-    case DUT(insert_head):
-        for (size_t i = 0; i < N_MEASURES; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(insert_tail):
-        for (size_t i = 0; i < N_MEASURES; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(remove_head):
-        for (size_t i = 0; i < N_MEASURES; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    case DUT(remove_tail):
-        for (size_t i = 0; i < N_MEASURES; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
+    assert(mode >= 0 && mode < (int) (sizeof(fixtures) / sizeof(fixtures[0])));
+    const dut_fixture_t *fx = &fixtures[mode];
+    assert(fx->op);
+
+    if (!pool && !dut_build(get_random_string()))
+        return false;
+
+    for (size_t i = 0; i < N_MEASURES; i++) {
+        char *s = get_random_string();
+        size_t n =
+            *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + fx->extra;
+        assert(n <= POOL_SIZE);
+        dut_take(n);
+        /* Cutting a long queue writes to elements far from the head; let
+         * those stores complete before the clock starts.
+         */
+        __sync_synchronize();
+        before_ticks[i] = cpucycles();
+        element_t *e = fx->op(s);
+        after_ticks[i] = cpucycles();
+        int after_size = q_size(l);
+        if ((int) n + fx->delta != after_size ||
+            (fx->undo && !fx->undo(e, s, n))) {
+            /* The pool can no longer be trusted: rebuild it next batch */
             if (e)
                 q_release_element(e);
             dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    default:
-        for (size_t i = 0; i < N_MEASURES; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
+            return false;
         }
+        dut_put();
     }
     return true;
 }
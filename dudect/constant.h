@@ -12,21 +12,31 @@
 
 #define DROP_SIZE 20
 
-#define DUT_FUNCS  \
-    _(insert_head) \
-    _(insert_tail) \
-    _(remove_head) \
-    _(remove_tail)
+/* Operations under test: name, qtest command, and expected complexity class
+ * as a complexity_t suffix.  Constant-time operations are checked with the
+ * t-tests and need a row in the fixture table of constant.c.  The others are
+ * checked with the complexity estimator, which looks them up by command.
+ */
+#define DUT_FUNCS                    \
+    _(insert_head, ih, 1)            \
+    _(insert_tail, it, 1)            \
+    _(remove_head, rh, 1)            \
+    _(remove_tail, rt, 1)            \
+    _(size, size, N)                 \
+    _(delete_mid, dm, N)             \
+    _(swap, swap, N)                 \
+    _(reverse, reverse, N)
 
 #define DUT(x) DUT_##x
 
 enum {
-#define _(x) DUT(x),
+#define _(x, cmd, c) DUT(x),
     DUT_FUNCS
 #undef _
 };
 
 void init_dut();
+void free_dut(void);
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
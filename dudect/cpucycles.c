@@ -0,0 +1,234 @@
+/**
+ * Timing backends for dudect.
+ *
+ * Besides the raw cycle counter, measurements can be taken with a serialized
+ * counter read, the raw monotonic clock, or a Linux perf_event counter of
+ * user-space cycles or retired instructions.  Perf counters are read with
+ * rdpmc from the mmap'ed control page when the kernel allows it, and with
+ * read(2) otherwise.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "../report.h"
+#include "cpucycles.h"
+
+int cpucycles_backend = CPUCYCLES_RDTSC;
+
+static const char *backend_names[CPUCYCLES_NR] = {
+    [CPUCYCLES_RDTSC] = "rdtsc",
+    [CPUCYCLES_RDTSCP] = "rdtscp+lfence",
+    [CPUCYCLES_MONOTONIC] = "clock_monotonic_raw",
+    [CPUCYCLES_PERF_CYCLES] = "perf cycles",
+    [CPUCYCLES_PERF_INSTR] = "perf instructions",
+};
+
+/* Perf counter of the calling thread.  Each measuring thread owns its own
+ * event so that counts never mix across CPUs.
+ */
+static __thread int perf_fd = -1;
+static __thread int perf_config = -1;
+#if defined(__linux__)
+static __thread volatile struct perf_event_mmap_page *perf_page = NULL;
+#endif
+
+const char *cpucycles_name(void)
+{
+    if (cpucycles_backend < 0 || cpucycles_backend >= CPUCYCLES_NR)
+        return "unknown";
+    return backend_names[cpucycles_backend];
+}
+
+int64_t cpucycles_monotonic(void)
+{
+    struct timespec ts;
+#if defined(CLOCK_MONOTONIC_RAW)
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool have_rdtscp(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+        return false;
+    return edx & (1u << 27);
+#else
+    return true;
+#endif
+}
+
+#if defined(__linux__)
+static inline uint64_t rdpmc(unsigned int counter)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int lo, hi;
+    __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+    return ((uint64_t) hi << 32) | lo;
+#else
+    (void) counter;
+    return 0;
+#endif
+}
+
+static bool can_rdpmc(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return perf_page && perf_page->cap_user_rdpmc;
+#else
+    return false;
+#endif
+}
+
+static int64_t perf_read_syscall(void)
+{
+    uint64_t count = 0;
+    if (read(perf_fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return (int64_t) count;
+}
+#endif
+
+int64_t cpucycles_perf(void)
+{
+#if defined(__linux__)
+    if (perf_fd < 0)
+        return 0;
+    if (!can_rdpmc())
+        return perf_read_syscall();
+
+    /* Seqlock protocol from include/uapi/linux/perf_event.h */
+    uint32_t seq;
+    int64_t count;
+    do {
+        seq = perf_page->lock;
+        __asm__ volatile("" ::: "memory");
+        uint32_t idx = perf_page->index;
+        count = perf_page->offset;
+        if (idx) {
+            unsigned int width = perf_page->pmc_width;
+            int64_t pmc = (int64_t) rdpmc(idx - 1);
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+            count += pmc;
+        }
+        __asm__ volatile("" ::: "memory");
+    } while (perf_page->lock != seq);
+    return count;
+#else
+    return 0;
+#endif
+}
+
+void cpucycles_thread_exit(void)
+{
+#if defined(__linux__)
+    if (perf_page) {
+        munmap((void *) perf_page, sysconf(_SC_PAGESIZE));
+        perf_page = NULL;
+    }
+#endif
+    if (perf_fd >= 0) {
+        close(perf_fd);
+        perf_fd = -1;
+    }
+    perf_config = -1;
+}
+
+static bool perf_open(int backend)
+{
+#if defined(__linux__)
+    int config = backend == CPUCYCLES_PERF_CYCLES ? PERF_COUNT_HW_CPU_CYCLES
+                                                  : PERF_COUNT_HW_INSTRUCTIONS;
+    if (perf_fd >= 0 && perf_config == config)
+        return true;
+    cpucycles_thread_exit();
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0)
+        return false;
+    perf_fd = fd;
+    perf_config = config;
+
+    /* Without the control page we still count, through read(2) */
+    void *page =
+        mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    if (page != MAP_FAILED)
+        perf_page = page;
+    return true;
+#else
+    (void) backend;
+    return false;
+#endif
+}
+
+bool cpucycles_thread_init(void)
+{
+    switch (cpucycles_backend) {
+    case CPUCYCLES_PERF_CYCLES:
+    case CPUCYCLES_PERF_INSTR:
+        return perf_open(cpucycles_backend);
+    default:
+        cpucycles_thread_exit();
+        return true;
+    }
+}
+
+bool cpucycles_select(int which)
+{
+    if (which < 0 || which >= CPUCYCLES_NR) {
+        report(1, "Unknown timing backend %d, valid range is 0 to %d", which,
+               CPUCYCLES_NR - 1);
+        cpucycles_backend = CPUCYCLES_RDTSC;
+        return false;
+    }
+
+    cpucycles_backend = which;
+    if (which == CPUCYCLES_RDTSCP && !have_rdtscp()) {
+        report(3, "Warning: rdtscp unsupported on this CPU, using %s",
+               backend_names[CPUCYCLES_MONOTONIC]);
+        cpucycles_backend = CPUCYCLES_MONOTONIC;
+        return false;
+    }
+    if (!cpucycles_thread_init()) {
+        /* Serialized counter reads are the closest stand-in */
+        cpucycles_backend =
+            have_rdtscp() ? CPUCYCLES_RDTSCP : CPUCYCLES_MONOTONIC;
+        report(3, "Warning: perf_event_open unavailable, using %s",
+               backend_names[cpucycles_backend]);
+        return false;
+    }
+#if defined(__linux__)
+    if ((which == CPUCYCLES_PERF_CYCLES || which == CPUCYCLES_PERF_INSTR) &&
+        !can_rdpmc())
+        report(3, "Warning: rdpmc not permitted, perf counters are read with "
+                  "a system call");
+#endif
+    return true;
+}
@@ -1,12 +1,49 @@
 #ifndef DUDECT_CPUCYCLES_H
 #define DUDECT_CPUCYCLES_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
-// http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
-static inline int64_t cpucycles(void)
+/* Timing backends for the measurement loop.  The default stays the bare
+ * cycle counter; the others trade a little overhead for measurements that
+ * out-of-order execution cannot smear across the timed region.
+ */
+typedef enum {
+    CPUCYCLES_RDTSC,        /* rdtsc / cntvct_el0, unserialized */
+    CPUCYCLES_RDTSCP,       /* rdtscp + lfence / isb + cntvct_el0 + isb */
+    CPUCYCLES_MONOTONIC,    /* clock_gettime(CLOCK_MONOTONIC_RAW), in ns */
+    CPUCYCLES_PERF_CYCLES,  /* perf_event_open user cycles, read by rdpmc */
+    CPUCYCLES_PERF_INSTR,   /* perf_event_open user instructions */
+    CPUCYCLES_NR,
+} cpucycles_backend_t;
+
+/* Selected backend, read on every sample.  Change it with cpucycles_select */
+extern int cpucycles_backend;
+
+/* Switch to backend 'which'.  Prepares the calling thread's counters; when
+ * the backend is unusable here, warns and falls back to the next best one.
+ * Returns false if 'which' could not be honored.
+ */
+bool cpucycles_select(int which);
+
+/* Open the perf counter of the calling thread for the current backend.
+ * Threads that sample with a perf backend must call this first.
+ */
+bool cpucycles_thread_init(void);
+
+/* Release the perf counter of the calling thread */
+void cpucycles_thread_exit(void);
+
+/* Human-readable name of the current backend, e.g. for reports */
+const char *cpucycles_name(void);
+
+int64_t cpucycles_monotonic(void);
+int64_t cpucycles_perf(void);
+
+static inline int64_t cpucycles_rdtsc(void)
 {
 #if defined(__i386__) || defined(__x86_64__)
+    // http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
     unsigned int hi, lo;
     __asm__ volatile("rdtsc\n\t" : "=a"(lo), "=d"(hi));
     return ((int64_t) lo) | (((int64_t) hi) << 32);
@@ -26,4 +63,40 @@ static inline int64_t cpucycles(void)
 #endif
 }
 
+/* rdtscp waits for all earlier instructions to retire before reading the
+ * counter, and the trailing lfence keeps later ones from starting early, so
+ * the read is ordered against the timed code on both sides.
+ */
+static inline int64_t cpucycles_rdtscp(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo, aux;
+    __asm__ volatile("rdtscp\n\tlfence\n\t"
+                     : "=a"(lo), "=d"(hi), "=c"(aux)::"memory");
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+
+#elif defined(__aarch64__)
+    uint64_t val;
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(val)::"memory");
+    return val;
+#else
+#error Unsupported Architecture
+#endif
+}
+
+static inline int64_t cpucycles(void)
+{
+    switch (cpucycles_backend) {
+    case CPUCYCLES_RDTSCP:
+        return cpucycles_rdtscp();
+    case CPUCYCLES_MONOTONIC:
+        return cpucycles_monotonic();
+    case CPUCYCLES_PERF_CYCLES:
+    case CPUCYCLES_PERF_INSTR:
+        return cpucycles_perf();
+    default:
+        return cpucycles_rdtsc();
+    }
+}
+
 #endif
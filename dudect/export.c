@@ -0,0 +1,128 @@
+/**
+ * Stream raw dudect measurements to a file for offline analysis.
+ *
+ * Records are gathered in a buffer of EXPORT_BUFSIZE bytes and written out
+ * only when it fills up or the export is closed, so that the measuring loop
+ * never waits for I/O on every sample.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../report.h"
+#include "constant.h"
+#include "cpucycles.h"
+#include "export.h"
+
+#define EXPORT_BUFSIZE (64 * 1024)
+
+/* Longest record: mode name, class and a 64-bit signed integer */
+#define EXPORT_RECORD_MAX 64
+
+static const char *mode_names[] = {
+#define _(x, cmd, c) #x,
+    DUT_FUNCS
+#undef _
+};
+
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+static int export_fd = -1;
+static export_format_t export_format;
+static char export_buf[EXPORT_BUFSIZE];
+static size_t export_len = 0;
+
+/* Call with export_lock held */
+static bool export_flush(void)
+{
+    size_t done = 0;
+    while (done < export_len) {
+        ssize_t n = write(export_fd, export_buf + done, export_len - done);
+        if (n < 0) {
+            report(1, "ERROR: Could not write measurements: %s",
+                   strerror(errno));
+            export_len = 0;
+            return false;
+        }
+        done += n;
+    }
+    export_len = 0;
+    return true;
+}
+
+static void export_append(const void *data, size_t len)
+{
+    if (export_len + len > EXPORT_BUFSIZE)
+        export_flush();
+    memcpy(export_buf + export_len, data, len);
+    export_len += len;
+}
+
+bool export_open(const char *path, export_format_t format)
+{
+    export_close();
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        report(1, "ERROR: Could not open '%s' for writing: %s", path,
+               strerror(errno));
+        return false;
+    }
+
+    pthread_mutex_lock(&export_lock);
+    export_fd = fd;
+    export_format = format;
+    if (format == EXPORT_CSV) {
+        const char header[] = "mode,class,ticks\n";
+        export_append(header, sizeof(header) - 1);
+    } else {
+        const char *timer = cpucycles_name();
+        export_append("DUDECT1\n", 8);
+        export_append(timer, strlen(timer) + 1);
+    }
+    pthread_mutex_unlock(&export_lock);
+    return true;
+}
+
+void export_close(void)
+{
+    pthread_mutex_lock(&export_lock);
+    if (export_fd >= 0) {
+        export_flush();
+        close(export_fd);
+        export_fd = -1;
+    }
+    pthread_mutex_unlock(&export_lock);
+}
+
+void export_batch(int mode,
+                  const uint8_t *classes,
+                  const int64_t *exec_times,
+                  size_t n)
+{
+    pthread_mutex_lock(&export_lock);
+    if (export_fd < 0) {
+        pthread_mutex_unlock(&export_lock);
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (export_format == EXPORT_CSV) {
+            char line[EXPORT_RECORD_MAX];
+            int len = snprintf(line, sizeof(line), "%s,%u,%lld\n",
+                               mode_names[mode], classes[i],
+                               (long long) exec_times[i]);
+            export_append(line, len);
+        } else {
+            uint8_t rec[10] = {mode, classes[i]};
+            uint64_t ticks = (uint64_t) exec_times[i];
+            for (int b = 0; b < 8; b++)
+                rec[2 + b] = ticks >> (8 * b);
+            export_append(rec, sizeof(rec));
+        }
+    }
+    pthread_mutex_unlock(&export_lock);
+}
@@ -0,0 +1,33 @@
+#ifndef DUDECT_EXPORT_H
+#define DUDECT_EXPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Raw measurement export.
+ *
+ * Every measurement of a batch is written, including those left out of the
+ * statistics.  CSV files hold a "mode,class,ticks" header and one line per
+ * measurement.
+ * Binary files start with the 8 bytes "DUDECT1\n" followed by the NUL
+ * terminated timer name, then one 10-byte record per measurement: mode and
+ * class as single bytes, and the ticks as a little-endian int64.
+ */
+typedef enum { EXPORT_CSV, EXPORT_BINARY } export_format_t;
+
+/* Start exporting to path, replacing a file already being written */
+bool export_open(const char *path, export_format_t format);
+
+/* Flush and close the export file, if any */
+void export_close(void);
+
+/* Append the measurements of one batch.  Safe to call from several
+ * measuring threads; each batch is written as a unit.
+ */
+void export_batch(int mode,
+                  const uint8_t *classes,
+                  const int64_t *exec_times,
+                  size_t n);
+
+#endif
@@ -26,8 +26,15 @@
  *    variable time.
  */
 
-#include <assert.h>
+/* Pinning threads to CPUs needs the GNU extensions of sched.h and pthread.h */
+#if defined(__linux__) || defined(__GNU__)
+#define _GNU_SOURCE
+#endif
+
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,17 +44,61 @@
 #include "../random.h"
 
 #include "constant.h"
+#include "cpucycles.h"
+#include "export.h"
 #include "fixture.h"
+#include "noise.h"
+#include "quantile.h"
 #include "ttest.h"
 
 #define ENOUGH_MEASURE 10000
+/* Fewest measurements for a cropped t-test to be taken into account */
+#define ENOUGH_CROPPED (ENOUGH_MEASURE / 10)
 #define TEST_TRIES 10
 
 /* Number of percentiles to calculate */
 #define NUM_PERCENTILES (100)
 #define DUDECT_TESTS (NUM_PERCENTILES + 1)
 
-static t_context_t *ctxs[DUDECT_TESTS];
+/* Statistics gathered by one measuring thread */
+typedef struct {
+    t_context_t ctxs[DUDECT_TESTS];
+    /* Cropping thresholds, estimated over all batches of a test */
+    quantile_t percentiles;
+    /* Batches found disturbed, dropped ones included */
+    size_t noisy;
+} dudect_state_t;
+
+/* Measuring thread of the parallel mode */
+typedef struct {
+    pthread_t thread;
+    dudect_state_t st;
+    int mode;
+    int batches;
+    int cpu;
+    bool ok;
+} worker_t;
+
+static dudect_state_t state;
+
+int dudect_workers = 1;
+int dudect_sequential = 0;
+int dudect_noise = NOISE_IGNORE;
+
+/* Times a disturbed batch is measured again before it is kept anyway */
+#define NOISE_RETRIES 5
+
+/* Sequential mode: smallest leak to detect, in standard deviations of the
+ * execution time, and the error rates of the whole test.  The leak is the
+ * one the fixed-size test barely flags: a t of t_threshold_moderate after
+ * ENOUGH_MEASURE samples, half of each class.  Rejecting is split over all
+ * DUDECT_TESTS t-tests (Bonferroni): the verdict rests on max_test(), which
+ * may pick any of them, and a false alarm on the picked one is a false alarm
+ * on one of them.
+ */
+#define SPRT_EFFECT 0.2
+#define SPRT_ALPHA 0.001
+#define SPRT_BETA 0.01
 
 /* threshold values for Welch's t-test */
 enum {
@@ -60,84 +111,116 @@ static void __attribute__((noreturn)) die(void)
     exit(111);
 }
 
-static int cmp(const int64_t *a, const int64_t *b)
+static void differentiate(int64_t *exec_times,
+                          const int64_t *before_ticks,
+                          const int64_t *after_ticks)
 {
-    return (int) (*a - *b);
+    for (size_t i = 0; i < N_MEASURES; i++)
+        exec_times[i] = after_ticks[i] - before_ticks[i];
 }
 
-static int64_t percentile(int64_t *a_sorted, double which, size_t size)
+/* Feed the batch to the quantile sketch.  Crop thresholds thus cover every
+ * measurement so far, not just those of the current batch.
+ */
+static void update_percentiles(dudect_state_t *st, const int64_t *exec_times)
 {
-    size_t array_position = (size_t) ((double) size * (double) which);
-    assert(array_position < size);
-    return a_sorted[array_position];
+    for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+        if (exec_times[i] <= 0)
+            continue;
+        quantile_push(&st->percentiles, exec_times[i]);
+    }
 }
 
-static void prepare_percentiles(int64_t *ctx)
+/* Number of cropping thresholds below or at x, by binary search */
+static size_t crop_bucket(const double *thresholds, double x)
 {
-    qsort(ctx, N_MEASURES, sizeof(int64_t),
-          (int (*)(const void *, const void *)) cmp);
-    for (size_t i = 0; i < N_MEASURES; i++) {
-        ctx[i] =
-            percentile(ctx, 1 - (pow(0.5, 10 * (double) (i + 1) / N_MEASURES)),
-                       N_MEASURES);
+    size_t lo = 0, hi = NUM_PERCENTILES;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (thresholds[mid] <= x)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    return lo;
 }
 
-static void differentiate(int64_t *exec_times,
-                          const int64_t *before_ticks,
-                          const int64_t *after_ticks)
+/* A measurement goes to the uncropped test and to every cropped test whose
+ * threshold exceeds it.  Rather than pushing it to each of those, it is
+ * pushed once to the bucket between two consecutive thresholds, and the
+ * buckets are merged into the tests by increasing threshold at the end of
+ * the batch.  Each sample thus costs one push to the quantile sketch and one
+ * to a bucket; the sketch, which checks all its markers, dominates.
+ */
+static void update_statistics(dudect_state_t *st,
+                              const int64_t *exec_times,
+                              uint8_t *classes)
 {
-    for (size_t i = 0; i < N_MEASURES; i++)
-        exec_times[i] = after_ticks[i] - before_ticks[i];
-}
+    update_percentiles(st, exec_times);
+
+    /* The sketch keeps its markers ordered, so the buckets nest */
+    double percentiles[NUM_PERCENTILES];
+    for (size_t j = 0; j < NUM_PERCENTILES; j++)
+        percentiles[j] = quantile_estimate(&st->percentiles, j);
+
+    t_context_t buckets[NUM_PERCENTILES + 1];
+    for (size_t j = 0; j <= NUM_PERCENTILES; j++)
+        t_init(&buckets[j]);
 
-static void update_statistics(const int64_t *exec_times,
-                              uint8_t *classes,
-                              int64_t *percentiles)
-{
     for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
         int64_t difference = exec_times[i];
         /* CPU cycle counter overflowed or dropped measurement */
         if (difference <= 0)
             continue;
 
-        /* do a t-test on the execution time */
-        t_push(ctxs[0], difference, classes[i]);
+        t_push(&buckets[crop_bucket(percentiles, difference)], difference,
+               classes[i]);
+    }
 
-        /* t-test on cropped execution times, for several cropping thresholds.
-         */
-        for (size_t j = 0; j < NUM_PERCENTILES; j++) {
-            if (difference < percentiles[j]) {
-                t_push(ctxs[j + 1], difference, classes[i]);
-            }
-        }
+    /* t-test on cropped execution times, for several cropping thresholds,
+     * then on the whole execution time.
+     */
+    t_context_t below;
+    t_init(&below);
+    for (size_t j = 0; j < NUM_PERCENTILES; j++) {
+        t_merge(&below, &buckets[j]);
+        t_merge(&st->ctxs[j + 1], &below);
     }
+    t_merge(&below, &buckets[NUM_PERCENTILES]);
+    t_merge(&st->ctxs[0], &below);
 }
 
-static t_context_t *max_test()
+static t_context_t *max_test(dudect_state_t *st)
 {
     size_t max_idx = 0;
     double max_t = 0.0f;
     for (size_t i = 0; i < NUM_PERCENTILES + 1; i++) {
-        double t = fabs(t_compute(ctxs[i]));
+        t_context_t *ctx = &st->ctxs[i];
+        if (i && ctx->n[0] + ctx->n[1] < ENOUGH_CROPPED)
+            continue;
+        double t = fabs(t_compute(ctx));
         if (t > max_t) {
             max_t = t;
             max_idx = i;
         }
     }
-    return ctxs[max_idx];
+    return &st->ctxs[max_idx];
 }
 
-static bool report(void)
+static bool report(dudect_state_t *st)
 {
-    t_context_t *t = max_test();
+    t_context_t *t = max_test(st);
+    double number_traces = st->ctxs[0].n[0] + st->ctxs[0].n[1];
     double number_traces_max_t = t->n[0] + t->n[1];
 
     printf("\033[A\033[2K");
-    printf("measure: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < ENOUGH_MEASURE) {
+    printf("measure: %7.2lf M (%s), ", (number_traces / 1e6),
+           cpucycles_name());
+    if (dudect_noise != NOISE_IGNORE)
+        printf("noisy batches: %zu, ", st->noisy);
+    if (number_traces < ENOUGH_MEASURE) {
         printf("not enough measurements (%.0f still to go).\n",
-               ENOUGH_MEASURE - number_traces_max_t);
+               ENOUGH_MEASURE - number_traces);
         return false;
     }
 
@@ -169,14 +252,14 @@ static bool report(void)
     return true;
 }
 
-static bool doit(int mode)
+/* Measure one batch and add it to the statistics in st */
+static bool measure_batch(dudect_state_t *st, int mode)
 {
     int64_t *before_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
     int64_t *after_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
     int64_t *exec_times = calloc(N_MEASURES, sizeof(int64_t));
     uint8_t *classes = calloc(N_MEASURES, sizeof(uint8_t));
     uint8_t *input_data = calloc(N_MEASURES * CHUNK_SIZE, sizeof(uint8_t));
-    int64_t *percentiles = calloc(NUM_PERCENTILES, sizeof(int64_t));
 
     if (!before_ticks || !after_ticks || !exec_times || !classes ||
         !input_data) {
@@ -185,59 +268,267 @@ static bool doit(int mode)
 
     prepare_inputs(input_data, classes);
 
-    bool ret = measure(before_ticks, after_ticks, input_data, mode);
+    /* A disturbed batch is dropped by measuring it again over its samples */
+    bool ret = true;
+    for (int tries = 0;; tries++) {
+        noise_snapshot_t before, after;
+        if (dudect_noise != NOISE_IGNORE)
+            noise_snapshot(&before);
+        ret &= measure(before_ticks, after_ticks, input_data, mode);
+        if (dudect_noise == NOISE_IGNORE)
+            break;
+        noise_snapshot(&after);
+        if (!noise_disturbed(&before, &after))
+            break;
+        st->noisy++;
+        if (dudect_noise != NOISE_DROP || tries == NOISE_RETRIES)
+            break;
+    }
     differentiate(exec_times, before_ticks, after_ticks);
-    prepare_percentiles(exec_times);
-    update_statistics(exec_times, classes, percentiles);
-    ret &= report();
+    export_batch(mode, classes, exec_times, N_MEASURES);
+    update_statistics(st, exec_times, classes);
 
     free(before_ticks);
     free(after_ticks);
     free(exec_times);
     free(classes);
     free(input_data);
-    free(percentiles);
 
     return ret;
 }
 
+static bool doit(int mode)
+{
+    bool ret = measure_batch(&state, mode);
+    ret &= report(&state);
+    return ret;
+}
+
+static void init_state(dudect_state_t *st)
+{
+    st->noisy = 0;
+    for (size_t i = 0; i < DUDECT_TESTS; i++)
+        t_init(&st->ctxs[i]);
+    double p[NUM_PERCENTILES];
+    for (size_t i = 0; i < NUM_PERCENTILES; i++)
+        p[i] = 1 - pow(0.5, 10 * (double) (i + 1) / NUM_PERCENTILES);
+    quantile_init(&st->percentiles, p, NUM_PERCENTILES);
+}
+
 static void init_once(void)
 {
     init_dut();
-    for (size_t i = 0; i < DUDECT_TESTS; i++) {
-        ctxs[i] = malloc(sizeof(t_context_t));
-        t_init(ctxs[i]);
+    init_state(&state);
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *w = arg;
+
+    /* The time limit alarm belongs to the main thread */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+#if defined(__linux__)
+    if (w->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(w->cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+
+    cpucycles_thread_init();
+    init_dut();
+    init_state(&w->st);
+    w->ok = true;
+    for (int i = 0; i < w->batches; i++)
+        w->ok &= measure_batch(&w->st, w->mode);
+    free_dut();
+    cpucycles_thread_exit();
+    return NULL;
+}
+
+/* CPUs this process may run on, in ascending order.  Returns their count */
+static int usable_cpus(int *cpus, int max)
+{
+    int cnt = 0;
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE && cnt < max; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                cpus[cnt++] = cpu;
+        }
     }
+#endif
+    return cnt;
+}
+
+/* Split the batches of one try over dudect_workers pinned threads, then
+ * merge their statistics as if a single thread had measured everything.
+ */
+static bool doit_parallel(int mode, int batches)
+{
+    int nworkers = dudect_workers;
+    worker_t *workers = calloc(nworkers, sizeof(worker_t));
+    int *cpus = calloc(nworkers, sizeof(int));
+    if (!workers || !cpus)
+        die();
+
+    int ncpus = usable_cpus(cpus, nworkers);
+    int started = 0;
+    for (int i = 0; i < nworkers; i++) {
+        worker_t *w = &workers[i];
+        w->mode = mode;
+        w->batches = batches / nworkers + (i < batches % nworkers);
+        w->cpu = ncpus ? cpus[i % ncpus] : -1;
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            /* Leave its share to the threads already running */
+            w->batches = 0;
+            break;
+        }
+        started++;
+    }
+
+    bool ok = started > 0;
+    init_state(&state);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ok &= workers[i].ok;
+        state.noisy += workers[i].st.noisy;
+        for (size_t j = 0; j < DUDECT_TESTS; j++)
+            t_merge(&state.ctxs[j], &workers[i].st.ctxs[j]);
+    }
+    ok &= report(&state);
+
+    free(workers);
+    free(cpus);
+    return ok;
+}
+
+/* Settle the verdict on the uncropped t-test and on the one with the largest
+ * t, the tests report() judges by.  Waiting for every crop to agree would
+ * keep a constant function measuring, and give each crop a chance to fail
+ * it.  A leak also needs a t above t_threshold_moderate, so that no function
+ * fails here with a t the fixed-size test accepts.
+ */
+static t_sprt_t sequential_verdict(dudect_state_t *st)
+{
+    t_context_t *tests[] = {&st->ctxs[0], max_test(st)};
+    size_t count = tests[1] == tests[0] ? 1 : 2;
+    t_sprt_t verdict = T_EQUAL;
+    for (size_t i = 0; i < count; i++) {
+        switch (t_sprt(tests[i], SPRT_EFFECT, SPRT_ALPHA / DUDECT_TESTS,
+                       SPRT_BETA)) {
+        case T_DIFFERENT:
+            if (fabs(t_compute(tests[i])) > t_threshold_moderate)
+                return T_DIFFERENT;
+            verdict = T_CONTINUE;
+            break;
+        case T_CONTINUE:
+            verdict = T_CONTINUE;
+            break;
+        default:
+            break;
+        }
+    }
+    return verdict;
+}
+
+/* Run each try of the fixed-size test until the sequential test settles it.
+ * A try left unsettled after its batches gets the fixed-size verdict, and a
+ * failed try is retried as in the fixed-size test.
+ */
+static bool test_sequential(char *text, int mode, int batches)
+{
+    bool result = false;
+
+    for (int cnt = 0; cnt < TEST_TRIES && !result; ++cnt) {
+        bool ok = true;
+        t_sprt_t verdict = T_CONTINUE;
+
+        printf("Testing %s...(sequential %d/%d)\n\n", text, cnt, TEST_TRIES);
+        init_once();
+        for (int i = 0; i < batches && verdict == T_CONTINUE; ++i) {
+            ok &= measure_batch(&state, mode);
+            report(&state);
+            verdict = sequential_verdict(&state);
+        }
+        free_dut();
+        printf("\033[A\033[2K\033[A\033[2K");
+
+        if (verdict == T_CONTINUE)
+            result = ok && report(&state);
+        else
+            result = ok && verdict == T_EQUAL;
+    }
+    return result;
 }
 
 static bool test_const(char *text, int mode)
 {
     bool result = false;
+    int batches = ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
+
+    if (dudect_sequential && dudect_workers <= 1)
+        return test_sequential(text, mode, batches);
 
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
         printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
-        init_once();
-        for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
-             ++i)
-            result = doit(mode);
+        if (dudect_workers > 1) {
+            result = doit_parallel(mode, batches);
+        } else {
+            init_once();
+            for (int i = 0; i < batches; ++i)
+                result = doit(mode);
+            free_dut();
+        }
         printf("\033[A\033[2K\033[A\033[2K");
         if (result)
             break;
     }
 
-    for (size_t i = 0; i < DUDECT_TESTS; i++) {
-        free(ctxs[i]);
-    }
-
     return result;
 }
 
-#define DUT_FUNC_IMPL(op)                \
-    bool is_##op##_const(void)           \
-    {                                    \
-        return test_const(#op, DUT(op)); \
+static const struct {
+    const char *name, *cmd;
+    complexity_t complexity;
+} duts[] = {
+#define _(x, cmd, c) [DUT(x)] = {#x, #cmd, COMPLEXITY_##c},
+    DUT_FUNCS
+#undef _
+};
+
+#define NR_DUTS (int) (sizeof(duts) / sizeof(duts[0]))
+
+int dut_find(const char *cmd)
+{
+    for (int mode = 0; mode < NR_DUTS; mode++) {
+        if (!strcmp(cmd, duts[mode].cmd))
+            return mode;
     }
+    return -1;
+}
 
-#define _(x) DUT_FUNC_IMPL(x)
-DUT_FUNCS
-#undef _
+complexity_t dut_complexity(int mode)
+{
+    return duts[mode].complexity;
+}
+
+bool dut_check(int mode)
+{
+    if (duts[mode].complexity == COMPLEXITY_1)
+        return test_const((char *) duts[mode].name, mode);
+
+    const complexity_op_t *op = complexity_find(duts[mode].cmd);
+    complexity_result_t res;
+    if (!op || !complexity_estimate(op, &res))
+        return false;
+    printf("%s grows as %s, confidence %.2f\n", duts[mode].name,
+           complexity_name(res.best), res.confidence);
+    return complexity_within(&res, duts[mode].complexity);
+}
@@ -2,11 +2,36 @@
 #define DUDECT_FIXTURE_H
 
 #include <stdbool.h>
+#include "complexity.h"
 #include "constant.h"
 
-/* Interface to test if function is constant */
-#define _(x) bool is_##x##_const(void);
-DUT_FUNCS
-#undef _
+/* Number of CPU-pinned threads measuring in parallel; 1 measures in the
+ * calling thread
+ */
+extern int dudect_workers;
+
+/* Stop measuring as soon as a sequential test settles the verdict */
+extern int dudect_sequential;
+
+/* What to do with batches disturbed by interrupts, CPU migration or
+ * frequency changes
+ */
+enum {
+    NOISE_IGNORE, /* measure as if the system were quiet */
+    NOISE_COUNT,  /* keep them, but report how many there were */
+    NOISE_DROP,   /* measure them again, a few times at most */
+};
+extern int dudect_noise;
+
+/* DUT mode run by the qtest command cmd, or -1 if there is none */
+int dut_find(const char *cmd);
+
+/* Expected complexity class of a DUT mode */
+complexity_t dut_complexity(int mode);
+
+/* Check a DUT mode against its expected complexity: t-tests for constant
+ * time, the complexity estimator otherwise.
+ */
+bool dut_check(int mode);
 
 #endif
@@ -0,0 +1,107 @@
+/**
+ * Detect batches disturbed by the system.
+ *
+ * Interrupts are counted from the column of /proc/interrupts that belongs to
+ * the current CPU, and its frequency is read from the cpufreq scaling_cur_freq
+ * attribute.  Both are Linux specific; elsewhere no batch is ever reported as
+ * disturbed.
+ */
+
+/* sched_getcpu() is a GNU extension */
+#if defined(__linux__) || defined(__GNU__)
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "noise.h"
+
+/* Largest relative frequency change left unnoticed */
+#define NOISE_FREQ_TOLERANCE 0.01
+
+#if defined(__linux__)
+static uint64_t read_interrupts(int cpu)
+{
+    FILE *f = fopen("/proc/interrupts", "r");
+    if (!f)
+        return 0;
+
+    char *line = NULL, *save, *tok;
+    size_t cap = 0;
+    int column = -1;
+    uint64_t total = 0;
+
+    /* The header names one column per online CPU: "CPU0 CPU1 ..." */
+    if (getline(&line, &cap, f) > 0) {
+        int i = 0;
+        for (tok = strtok_r(line, " \t\n", &save); tok;
+             tok = strtok_r(NULL, " \t\n", &save), i++) {
+            if (!strncmp(tok, "CPU", 3) && atoi(tok + 3) == cpu) {
+                column = i;
+                break;
+            }
+        }
+    }
+
+    /* Then each line is a label like "24:" or "LOC:" followed by counts */
+    while (column >= 0 && getline(&line, &cap, f) > 0) {
+        tok = strtok_r(line, " \t\n", &save);
+        for (int i = 0; tok && i <= column; i++)
+            tok = strtok_r(NULL, " \t\n", &save);
+        if (tok && isdigit((unsigned char) *tok))
+            total += strtoull(tok, NULL, 10);
+    }
+
+    free(line);
+    fclose(f);
+    return total;
+}
+
+static long read_khz(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    long khz = 0;
+    if (fscanf(f, "%ld", &khz) != 1)
+        khz = 0;
+    fclose(f);
+    return khz;
+}
+#endif
+
+void noise_snapshot(noise_snapshot_t *snap)
+{
+    snap->cpu = -1;
+    snap->interrupts = 0;
+    snap->khz = 0;
+#if defined(__linux__)
+    snap->cpu = sched_getcpu();
+    if (snap->cpu < 0)
+        return;
+    snap->interrupts = read_interrupts(snap->cpu);
+    snap->khz = read_khz(snap->cpu);
+#endif
+}
+
+bool noise_disturbed(const noise_snapshot_t *before,
+                     const noise_snapshot_t *after)
+{
+    if (before->cpu != after->cpu)
+        return true;
+    if (after->interrupts != before->interrupts)
+        return true;
+    if (before->khz && after->khz) {
+        long diff = labs(after->khz - before->khz);
+        if (diff > before->khz * NOISE_FREQ_TOLERANCE)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,25 @@
+#ifndef DUDECT_NOISE_H
+#define DUDECT_NOISE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* What may disturb a batch, as seen from the CPU the calling thread runs on.
+ * Fields that cannot be read on this system are left at 0 and ignored.
+ */
+typedef struct {
+    int cpu;             /* CPU the thread ran on, -1 if unknown */
+    uint64_t interrupts; /* interrupts served by that CPU so far */
+    long khz;            /* its current frequency */
+} noise_snapshot_t;
+
+void noise_snapshot(noise_snapshot_t *snap);
+
+/* Whether a batch measured between two snapshots was disturbed: the thread
+ * moved to another CPU, the CPU served an interrupt, or its frequency
+ * changed.
+ */
+bool noise_disturbed(const noise_snapshot_t *before,
+                     const noise_snapshot_t *after);
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ * Streaming estimation of several quantiles with the extended P-square
+ * algorithm.
+ *
+ * Markers track the minimum, each requested quantile and the maximum.  Each
+ * observation is located among the markers by binary search, shifting the
+ * positions of all markers above it.  A marker that drifts one or more
+ * positions away from where it should be is then moved by one, with its
+ * height adjusted by a piecewise-parabolic fit through its neighbours.  An
+ * update takes one pass over the markers, and no sample is stored.
+ *
+ * See R. Jain and I. Chlamtac, "The P^2 algorithm for dynamic calculation of
+ * quantiles and histograms without storing observations", CACM 28(10), 1985,
+ * whose histogram variant places markers at arbitrary quantiles, and
+ * K. Raatikainen, "Simultaneous estimation of several percentiles",
+ * Simulation 49(4), 1987.
+ */
+
+#include <assert.h>
+#include <math.h>
+
+#include "quantile.h"
+
+void quantile_init(quantile_t *q, const double *p, size_t count)
+{
+    assert(count > 0 && count <= QUANTILE_MAX);
+    q->markers = count + 2;
+    q->n = 0;
+    q->p[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        assert(p[i] > q->p[i] && p[i] < 1);
+        q->p[i + 1] = p[i];
+    }
+    q->p[count + 1] = 1;
+    for (size_t i = 0; i < q->markers; i++) {
+        q->height[i] = 0.0;
+        q->pos[i] = i + 1;
+    }
+}
+
+static double parabolic(const quantile_t *q, size_t i, double d)
+{
+    const double *h = q->height, *n = q->pos;
+    return h[i] + d / (n[i + 1] - n[i - 1]) *
+                      ((n[i] - n[i - 1] + d) * (h[i + 1] - h[i]) /
+                           (n[i + 1] - n[i]) +
+                       (n[i + 1] - n[i] - d) * (h[i] - h[i - 1]) /
+                           (n[i] - n[i - 1]));
+}
+
+static double linear(const quantile_t *q, size_t i, int d)
+{
+    const double *h = q->height, *n = q->pos;
+    return h[i] + d * (h[i + d] - h[i]) / (n[i + d] - n[i]);
+}
+
+void quantile_push(quantile_t *q, double x)
+{
+    size_t m = q->markers;
+
+    /* The first observations become the markers, kept sorted */
+    if (q->n < m) {
+        size_t i = q->n++;
+        while (i > 0 && q->height[i - 1] > x) {
+            q->height[i] = q->height[i - 1];
+            i--;
+        }
+        q->height[i] = x;
+        return;
+    }
+    q->n++;
+
+    /* Find the cell k holding x, stretching the extremes if needed */
+    size_t k;
+    if (x < q->height[0]) {
+        q->height[0] = x;
+        k = 0;
+    } else if (x >= q->height[m - 1]) {
+        q->height[m - 1] = x;
+        k = m - 2;
+    } else {
+        size_t lo = 0, hi = m - 1;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (q->height[mid] <= x)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        k = lo;
+    }
+    double *pos = q->pos;
+    for (size_t i = k + 1; i < m; i++)
+        pos[i]++;
+
+    /* Move the inner markers that drifted a position or more, unless a
+     * neighbour leaves no room
+     */
+    double last = q->n - 1;
+    for (size_t i = 1; i < m - 1; i++) {
+        double d = 1 + last * q->p[i] - pos[i];
+        if (fabs(d) < 1)
+            continue;
+        int s = d > 0 ? 1 : -1;
+        if (pos[i + s] - pos[i] == s)
+            continue;
+        double h = parabolic(q, i, s);
+        if (q->height[i - 1] < h && h < q->height[i + 1])
+            q->height[i] = h;
+        else
+            q->height[i] = linear(q, i, s);
+        pos[i] += s;
+    }
+}
+
+double quantile_estimate(const quantile_t *q, size_t i)
+{
+    assert(i + 2 < q->markers);
+    if (q->n >= q->markers)
+        return q->height[i + 1];
+    if (q->n == 0)
+        return 0.0;
+
+    /* Too few observations for the markers: pick from the sorted samples */
+    size_t j = (size_t) (q->p[i + 1] * q->n);
+    return q->height[j < q->n ? j : q->n - 1];
+}
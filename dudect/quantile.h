@@ -0,0 +1,29 @@
+#ifndef DUDECT_QUANTILE_H
+#define DUDECT_QUANTILE_H
+
+#include <stddef.h>
+
+/* Largest number of quantiles one sketch tracks */
+#define QUANTILE_MAX 100
+
+/* Extended P-square estimate of several quantiles in constant space: one
+ * marker per quantile, plus the minimum and the maximum
+ */
+typedef struct {
+    size_t markers;                   /* quantiles tracked plus 2 */
+    size_t n;                         /* observations so far */
+    double p[QUANTILE_MAX + 2];       /* marker probabilities, 0 to 1 */
+    double height[QUANTILE_MAX + 2];  /* marker heights */
+    double pos[QUANTILE_MAX + 2];     /* actual marker positions, 1-based */
+} quantile_t;
+
+/* Track the count quantiles p[0] < p[1] < ... , each strictly between 0
+ * and 1
+ */
+void quantile_init(quantile_t *q, const double *p, size_t count);
+void quantile_push(quantile_t *q, double x);
+
+/* Estimate of the i-th quantile passed to quantile_init() */
+double quantile_estimate(const quantile_t *q, size_t i);
+
+#endif
@@ -47,3 +47,48 @@ void t_init(t_context_t *ctx)
     }
     return;
 }
+
+/* Fold the samples of src into dst, as if they had all been pushed to dst.
+ * Uses the pairwise update of Chan, Golub and LeVeque for the variance.
+ */
+void t_merge(t_context_t *dst, const t_context_t *src)
+{
+    for (int class = 0; class < 2; class ++) {
+        double n = dst->n[class] + src->n[class];
+        if (n == 0)
+            continue;
+        double delta = src->mean[class] - dst->mean[class];
+        dst->mean[class] += delta * src->n[class] / n;
+        dst->m2[class] += src->m2[class] +
+                          delta * delta * dst->n[class] * src->n[class] / n;
+        dst->n[class] = n;
+    }
+}
+
+/* Wald's sequential probability ratio test on the t statistic.
+ *
+ * With m = n0 * n1 / (n0 + n1), t is approximately N(d * sqrt(m), 1) for a
+ * standardized mean difference d.  The log-likelihood ratio of d = effect
+ * against d = 0, taken on |t| to cover both directions, is
+ *   effect * sqrt(m) * |t| - effect^2 * m / 2.
+ * It is compared with log((1 - beta) / alpha) and log(beta / (1 - alpha)),
+ * which bound the rates of false alarms and missed differences by alpha and
+ * beta, however often the test is repeated while samples come in.
+ */
+t_sprt_t t_sprt(t_context_t *ctx, double effect, double alpha, double beta)
+{
+    if (ctx->n[0] < 2 || ctx->n[1] < 2)
+        return T_CONTINUE;
+
+    double m = ctx->n[0] * ctx->n[1] / (ctx->n[0] + ctx->n[1]);
+    double t = fabs(t_compute(ctx));
+    if (isnan(t))
+        return T_CONTINUE;
+
+    double llr = effect * sqrt(m) * t - effect * effect * m / 2;
+    if (llr >= log((1 - beta) / alpha))
+        return T_DIFFERENT;
+    if (llr <= log(beta / (1 - alpha)))
+        return T_EQUAL;
+    return T_CONTINUE;
+}
@@ -12,5 +12,15 @@ typedef struct {
 void t_push(t_context_t *ctx, double x, uint8_t class);
 double t_compute(t_context_t *ctx);
 void t_init(t_context_t *ctx);
+void t_merge(t_context_t *dst, const t_context_t *src);
+
+/* Outcome of a sequential probability ratio test */
+typedef enum {
+    T_CONTINUE, /* not settled yet, keep measuring */
+    T_EQUAL,    /* means differ by less than the effect size */
+    T_DIFFERENT /* means differ by at least the effect size */
+} t_sprt_t;
+
+t_sprt_t t_sprt(t_context_t *ctx, double effect, double alpha, double beta);
 
 #endif
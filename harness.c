@@ -1,11 +1,15 @@
 /* Test support code */
 
+#include <math.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -19,6 +23,12 @@
 /* Value at start of every allocated block */
 #define MAGICHEADER 0xdeadbeef
 
+/* Value at start of every block placed against a guard page */
+#define MAGICGUARD 0xfeedface
+
+/* Value at start of every block carved out of an arena */
+#define MAGICARENA 0xbadcafe
+
 /* Value when deallocate block */
 #define MAGICFREE 0xffffffff
 
@@ -28,36 +38,165 @@
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
+/* Alignment of payloads placed against a guard page. Overruns into the
+ * slack before the guard page are caught by test_free instead, which checks
+ * that the slack still holds GUARDFILL.
+ */
+#define GUARD_ALIGN sizeof(size_t)
+#define GUARDFILL 0xa5
+
+/* Number of freed guard blocks kept inaccessible before being unmapped */
+#define GUARD_QUARANTINE 256
+
+/* Size of the chunks arenas carve their blocks from */
+#define ARENA_CHUNK (64 * 1024)
+
+/* Arena blocks up to ARENA_CLASSES words are recycled through freelists */
+#define ARENA_CLASSES 32
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t) (a) - 1))
+
 /* Data structures used by our code */
 
+struct __shard;
+
 /* Represent allocated blocks as doubly-linked list, with
  * next and prev pointers at beginning
  */
 typedef struct __block_element {
     struct __block_element *next, *prev;
+    struct __shard *shard; /* Registry the block is linked into */
     size_t payload_size;
     size_t magic_header; /* Marker to see if block seems legitimate */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Each thread links its blocks into a registry shard of its own, so threads
+ * only contend when freeing blocks allocated by another thread. Shards are
+ * merged on demand by allocation_check and the cautious mode lookup. The shard
+ * of an exited thread is kept, since its blocks may still be alive, and is
+ * handed over to the next thread that starts allocating.
+ */
+typedef struct __shard {
+    pthread_mutex_t lock;
+    block_element_t *allocated;
+    size_t allocated_count;
+    size_t payload_bytes, harness_bytes, allocator_bytes;
+    bool orphaned; /* Owning thread has exited */
+    struct __shard *next;
+} shard_t;
+
+static shard_t *shards = NULL;
+
+/* Footprint of all live blocks, and its maximum */
+static size_t footprint_bytes = 0, peak_bytes = 0;
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t shard_key;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+static __thread shard_t *local_shard = NULL;
+
+/* Serializes the guard quarantine and the fault injection schedule */
+static pthread_mutex_t harness_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Harness locks held by this thread, and an exception raised by a signal
+ * meanwhile.  Jumping out would leave the locks held for good, so the jump
+ * waits until the last one is released.
+ */
+static __thread volatile sig_atomic_t locks_held = 0;
+static __thread char *volatile deferred_exception = NULL;
+
+static void acquire(pthread_mutex_t *lock)
+{
+    locks_held++;
+    pthread_mutex_lock(lock);
+}
+
+static void release(pthread_mutex_t *lock)
+{
+    pthread_mutex_unlock(lock);
+    if (--locks_held == 0 && deferred_exception) {
+        char *msg = deferred_exception;
+        deferred_exception = NULL;
+        trigger_exception(msg);
+    }
+}
+
+/* Arena blocks carry a shorter header, whose trailing fields line up with
+ * those of block_element_t so that test_free can tell them apart.
+ */
+typedef struct {
+    struct __arena *arena;
+    size_t payload_size;
+    size_t magic_header;
+    unsigned char payload[0];
+} arena_block_t;
+
+typedef struct __arena_chunk {
+    struct __arena_chunk *next;
+    unsigned char data[0];
+} arena_chunk_t;
+
+struct __arena {
+    arena_chunk_t *chunks;
+    unsigned char *bump, *limit; /* Unused part of the newest chunk */
+    void *freelist[ARENA_CLASSES + 1];
+};
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Place every new block against an inaccessible guard page */
+int guard_mode = 0;
+
+/* Freed guard blocks, kept PROT_NONE so that later accesses fault */
+static struct {
+    void *base;
+    size_t len;
+} quarantine[GUARD_QUARANTINE];
+static size_t quarantine_next = 0;
+static size_t page_size = 0;
+
+/* Fault injection schedule. Allocation attempts are numbered from 1 since the
+ * schedule was last set, and the index of every injected failure is logged so
+ * that the very same failures can be replayed later.
+ */
+typedef enum {
+    FAULT_RANDOM, /* random() against fail_probability, not reproducible */
+    FAULT_EVERY,  /* every Nth allocation */
+    FAULT_LIST,   /* allocations listed in fault_list */
+    FAULT_RATE,   /* Bernoulli process drawn from a recorded seed */
+} fault_mode_t;
+
+#define FAULT_LOG_MAX 4096
+
+static fault_mode_t fault_mode = FAULT_RANDOM;
+static size_t fault_index = 0;
+static size_t fault_every = 0, fault_countdown = 0;
+static size_t *fault_list = NULL;
+static size_t fault_list_len = 0, fault_list_pos = 0;
+static uint64_t fault_seed = 0, fault_state = 0, fault_threshold = 0;
+static int fault_percent = 0;
+static size_t fault_log[FAULT_LOG_MAX];
+static size_t fault_log_len = 0;
+static bool fault_log_lost = false;
+
+/* Cached threshold for FAULT_RANDOM, avoiding a division per allocation */
+static int random_percent = 0;
+static long random_threshold = 0;
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
-static bool error_occurred = false;
-static char *error_message = "";
+static atomic_bool error_occurred = false;
 
-static int time_limit = 1;
+/* Seconds a risky operation may run, 0 for no limit */
+int time_limit = 1;
 
-/* Data for managing exceptions */
-static jmp_buf env;
-static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+/* Data for managing exceptions, one context per thread */
+static __thread char *error_message = "";
+static __thread jmp_buf env;
+static __thread volatile sig_atomic_t jmp_ready = false;
+static __thread bool time_limited = false;
 
 /* For test_malloc and test_calloc */
 typedef enum {
@@ -67,11 +206,137 @@ typedef enum {
 
 /* Internal functions */
 
+/* splitmix64, see <http://xoshiro.di.unimi.it/splitmix64.c> */
+static uint64_t fault_next()
+{
+    uint64_t z = (fault_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    bool fail = false;
+    if (fault_mode == FAULT_RANDOM && !fail_probability) {
+        __atomic_add_fetch(&fault_index, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    acquire(&harness_lock);
+    __atomic_add_fetch(&fault_index, 1, __ATOMIC_RELAXED);
+    switch (fault_mode) {
+    case FAULT_RANDOM:
+        if (fail_probability != random_percent) {
+            random_percent = fail_probability;
+            random_threshold = (long) ceil(0.01 * random_percent * RAND_MAX);
+        }
+        fail = random() < random_threshold;
+        break;
+    case FAULT_EVERY:
+        if (--fault_countdown == 0) {
+            fault_countdown = fault_every;
+            fail = true;
+        }
+        break;
+    case FAULT_LIST:
+        while (fault_list_pos < fault_list_len &&
+               fault_list[fault_list_pos] < fault_index)
+            fault_list_pos++;
+        fail = fault_list_pos < fault_list_len &&
+               fault_list[fault_list_pos] == fault_index;
+        break;
+    case FAULT_RATE:
+        fail = fault_next() < fault_threshold;
+        break;
+    }
+
+    if (fail) {
+        if (fault_log_len < FAULT_LOG_MAX)
+            fault_log[fault_log_len++] = fault_index;
+        else
+            fault_log_lost = true;
+    }
+    release(&harness_lock);
+    return fail;
+}
+
+static void shard_orphan(void *arg)
+{
+    shard_t *shard = arg;
+    acquire(&shards_lock);
+    shard->orphaned = true;
+    release(&shards_lock);
+}
+
+static void shard_init()
+{
+    pthread_key_create(&shard_key, shard_orphan);
+    page_size = sysconf(_SC_PAGESIZE);
+}
+
+/* Registry shard of the calling thread, adopting or creating one on first use
+ */
+static shard_t *get_shard()
+{
+    if (local_shard)
+        return local_shard;
+
+    pthread_once(&shard_once, shard_init);
+    acquire(&shards_lock);
+    shard_t *shard = shards;
+    while (shard && !shard->orphaned)
+        shard = shard->next;
+    if (shard) {
+        shard->orphaned = false;
+    } else {
+        shard = malloc(sizeof(shard_t));
+        if (!shard)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        // cppcheck-suppress nullPointerRedundantCheck
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->allocated = NULL;
+        shard->allocated_count = 0;
+        shard->payload_bytes = shard->harness_bytes = 0;
+        shard->allocator_bytes = 0;
+        shard->orphaned = false;
+        shard->next = shards;
+        shards = shard;
+    }
+    release(&shards_lock);
+
+    pthread_setspecific(shard_key, shard);
+    local_shard = shard;
+    return shard;
+}
+
+static bool shard_holds(shard_t *shard, const block_element_t *b)
+{
+    bool found = false;
+    acquire(&shard->lock);
+    for (block_element_t *ab = shard->allocated; ab && !found; ab = ab->next)
+        found = ab == b;
+    release(&shard->lock);
+    return found;
+}
+
+/* Is b linked into any registry shard? Blocks are mostly freed by the thread
+ * that allocated them, so the shard of the calling thread is searched first.
+ */
+static bool is_allocated(const block_element_t *b)
+{
+    if (local_shard && shard_holds(local_shard, b))
+        return true;
+
+    bool found = false;
+    acquire(&shards_lock);
+    for (shard_t *shard = shards; shard && !found; shard = shard->next) {
+        if (shard != local_shard)
+            found = shard_holds(shard, b);
+    }
+    release(&shards_lock);
+    return found;
 }
 
 /* Find header of block, given its payload.
@@ -88,13 +353,7 @@ static block_element_t *find_header(void *p)
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+        if (!is_allocated(b)) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
@@ -102,7 +361,7 @@ static block_element_t *find_header(void *p)
         }
     }
 
-    if (b->magic_header != MAGICHEADER) {
+    if (b->magic_header != MAGICHEADER && b->magic_header != MAGICGUARD) {
         report_event(
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
@@ -122,6 +381,105 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
+/* Estimate the bookkeeping and rounding the system allocator adds to a request
+ * of req bytes, modeled on glibc's ptmalloc: one size word per chunk, chunks
+ * aligned to two words and never smaller than four words.
+ */
+static size_t allocator_overhead(size_t req)
+{
+    size_t chunk = ALIGN_UP(req + sizeof(size_t), 2 * sizeof(size_t));
+    if (chunk < 4 * sizeof(size_t))
+        chunk = 4 * sizeof(size_t);
+    return chunk - req;
+}
+
+/* Given pointer to guard block, find the whole mapping holding it.
+ * The payload ends exactly where the guard page starts.
+ */
+static void guard_span(block_element_t *b, void **base, size_t *len)
+{
+    size_t payload = ALIGN_UP(b->payload_size, GUARD_ALIGN);
+    size_t span = ALIGN_UP(sizeof(block_element_t) + payload, page_size);
+    *base = (void *) ((size_t) b->payload + payload - span);
+    *len = span + page_size;
+}
+
+/* Bytes the harness and the system allocator spend on block b besides its
+ * payload. Guard blocks are whole mappings, with no allocator bookkeeping.
+ */
+static void block_cost(block_element_t *b, size_t *harness, size_t *allocator)
+{
+    if (b->magic_header == MAGICGUARD) {
+        void *base;
+        size_t len;
+        guard_span(b, &base, &len);
+        *harness = len - b->payload_size;
+        *allocator = 0;
+    } else {
+        size_t req = b->payload_size + sizeof(block_element_t) + sizeof(size_t);
+        *harness = req - b->payload_size;
+        *allocator = allocator_overhead(req);
+    }
+}
+
+/* Map a block whose payload is immediately followed by a PROT_NONE page,
+ * so that any overrun faults at the offending instruction.
+ */
+static block_element_t *guard_alloc(size_t size)
+{
+    size_t payload = ALIGN_UP(size, GUARD_ALIGN);
+    size_t span = ALIGN_UP(sizeof(block_element_t) + payload, page_size);
+    unsigned char *base = mmap(NULL, span + page_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    if (mprotect(base + span, page_size, PROT_NONE)) {
+        munmap(base, span + page_size);
+        return NULL;
+    }
+    return (block_element_t *) (base + span - payload -
+                                sizeof(block_element_t));
+}
+
+/* Fill the slack between the payload of guard block b and its guard page */
+static void guard_fill(block_element_t *b)
+{
+    size_t slack = ALIGN_UP(b->payload_size, GUARD_ALIGN) - b->payload_size;
+    memset(b->payload + b->payload_size, GUARDFILL, slack);
+}
+
+/* Whether the slack of guard block b is as guard_fill() left it */
+static bool guard_intact(const block_element_t *b)
+{
+    size_t slack = ALIGN_UP(b->payload_size, GUARD_ALIGN) - b->payload_size;
+    for (size_t i = 0; i < slack; i++) {
+        if (b->payload[b->payload_size + i] != GUARDFILL)
+            return false;
+    }
+    return true;
+}
+
+/* Revoke all access to a freed guard block and park it in the quarantine,
+ * so that use-after-free faults as well. The oldest entry is unmapped once
+ * the quarantine is full.
+ */
+static void guard_release(block_element_t *b)
+{
+    void *base;
+    size_t len;
+    guard_span(b, &base, &len);
+    mprotect(base, len - page_size, PROT_NONE);
+
+    acquire(&harness_lock);
+    if (quarantine[quarantine_next].base)
+        munmap(quarantine[quarantine_next].base,
+               quarantine[quarantine_next].len);
+    quarantine[quarantine_next].base = base;
+    quarantine[quarantine_next].len = len;
+    quarantine_next = (quarantine_next + 1) % GUARD_QUARANTINE;
+    release(&harness_lock);
+}
+
 static void *alloc(alloc_t alloc_type, size_t size)
 {
     if (noallocate_mode) {
@@ -142,29 +500,55 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
+    shard_t *shard = get_shard();
     block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+        guard_mode ? guard_alloc(size)
+                   : malloc(size + sizeof(block_element_t) + sizeof(size_t));
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
         error_occurred = true;
     }
 
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
-    *find_footer(new_block) = MAGICFOOTER;
+    if (guard_mode) {
+        /* The guard page and the filled slack replace the footer */
+        new_block->magic_header = MAGICGUARD;
+        guard_fill(new_block);
+    } else {
+        new_block->magic_header = MAGICHEADER;
+        *find_footer(new_block) = MAGICFOOTER;
+    }
     void *p = (void *) &new_block->payload;
     memset(p, !alloc_type * FILLCHAR, size);
+
+    size_t harness, allocator;
+    block_cost(new_block, &harness, &allocator);
+    size_t footprint =
+        __atomic_add_fetch(&footprint_bytes, size + harness + allocator,
+                           __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    while (footprint > peak &&
+           !__atomic_compare_exchange_n(&peak_bytes, &peak, footprint, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    acquire(&shard->lock);
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
+    new_block->shard = shard;
+    // cppcheck-suppress nullPointerRedundantCheck
+    new_block->next = shard->allocated;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->prev = NULL;
 
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    if (shard->allocated)
+        shard->allocated->prev = new_block;
+    shard->allocated = new_block;
+    shard->allocated_count++;
+    shard->payload_bytes += size;
+    shard->harness_bytes += harness;
+    shard->allocator_bytes += allocator;
+    release(&shard->lock);
 
     return p;
 }
@@ -187,6 +571,8 @@ void *test_calloc(size_t nelem, size_t elsize)
     return alloc(TEST_CALLOC, nelem * elsize);
 }
 
+static void arena_release(void *p);
+
 void test_free(void *p)
 {
     if (noallocate_mode) {
@@ -197,31 +583,51 @@ void test_free(void *p)
     if (!p)
         return;
 
+    if (arena_of(p)) {
+        arena_release(p);
+        return;
+    }
+
     block_element_t *b = find_header(p);
-    size_t footer = *find_footer(b);
-    if (footer != MAGICFOOTER) {
+    bool guarded = b->magic_header == MAGICGUARD;
+    size_t harness, allocator;
+    block_cost(b, &harness, &allocator);
+    bool intact = guarded ? guard_intact(b) : *find_footer(b) == MAGICFOOTER;
+    if (!intact) {
         report_event(MSG_ERROR,
                      "Corruption detected in block with address %p when "
                      "attempting to free it",
                      p);
         error_occurred = true;
     }
+    if (!guarded)
+        *find_footer(b) = MAGICFREE;
     b->magic_header = MAGICFREE;
-    *find_footer(b) = MAGICFREE;
     memset(p, FILLCHAR, b->payload_size);
+    __atomic_sub_fetch(&footprint_bytes, b->payload_size + harness + allocator,
+                       __ATOMIC_RELAXED);
 
     /* Unlink from list */
+    shard_t *shard = b->shard;
+    acquire(&shard->lock);
     block_element_t *bn = b->next;
     block_element_t *bp = b->prev;
     if (bp)
         bp->next = bn;
     else
-        allocated = bn;
+        shard->allocated = bn;
     if (bn)
         bn->prev = bp;
-
-    free(b);
-    allocated_count--;
+    shard->allocated_count--;
+    shard->payload_bytes -= b->payload_size;
+    shard->harness_bytes -= harness;
+    shard->allocator_bytes -= allocator;
+    release(&shard->lock);
+
+    if (guarded)
+        guard_release(b);
+    else
+        free(b);
 }
 
 // cppcheck-suppress unusedFunction
@@ -235,9 +641,181 @@ char *test_strdup(const char *s)
     return memcpy(new, s, len);
 }
 
+/* Capacity of an arena block able to hold size bytes, always large enough to
+ * keep the freelist link
+ */
+static size_t arena_capacity(size_t size)
+{
+    return size ? ALIGN_UP(size, sizeof(void *)) : sizeof(void *);
+}
+
+arena_t *arena_new()
+{
+    arena_t *arena = test_malloc(sizeof(arena_t));
+    if (!arena)
+        return NULL;
+    memset(arena, 0, sizeof(arena_t));
+    return arena;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to malloc are disallowed");
+        return NULL;
+    }
+
+    size_t cap = arena_capacity(size);
+    size_t cls = cap / sizeof(void *);
+    size_t need = sizeof(arena_block_t) + cap;
+    bool pooled = cls <= ARENA_CLASSES && arena->freelist[cls];
+    bool refill = !pooled && (size_t) (arena->limit - arena->bump) < need;
+
+    /* Fail like malloc does, taking one fault index per allocation.  A
+     * refill goes through test_malloc(), which makes that check itself.
+     */
+    if (!refill && fail_allocation()) {
+        report_event(MSG_WARN, "Malloc returning NULL");
+        return NULL;
+    }
+
+    arena_block_t *b;
+    if (pooled) {
+        void *p = arena->freelist[cls];
+        arena->freelist[cls] = *(void **) p;
+        b = (arena_block_t *) ((size_t) p - sizeof(arena_block_t));
+    } else {
+        if (refill) {
+            /* Oversized blocks get a chunk of their own */
+            size_t len = need > ARENA_CHUNK - sizeof(arena_chunk_t)
+                             ? need + sizeof(arena_chunk_t)
+                             : ARENA_CHUNK;
+            arena_chunk_t *chunk = test_malloc(len);
+            if (!chunk)
+                return NULL;
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+            arena->bump = chunk->data;
+            arena->limit = (unsigned char *) chunk + len;
+        }
+        b = (arena_block_t *) arena->bump;
+        arena->bump += need;
+        b->arena = arena;
+    }
+
+    b->payload_size = size;
+    b->magic_header = MAGICARENA;
+    memset(b->payload, FILLCHAR, size);
+    return b->payload;
+}
+
+char *arena_strdup(arena_t *arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    void *new = arena_alloc(arena, len);
+    if (!new)
+        return NULL;
+
+    return memcpy(new, s, len);
+}
+
+void arena_free(arena_t *arena)
+{
+    if (!arena)
+        return;
+
+    arena_chunk_t *chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        test_free(chunk);
+        chunk = next;
+    }
+    test_free(arena);
+}
+
+arena_t *arena_of(const void *p)
+{
+    if (!p)
+        return NULL;
+    const arena_block_t *b =
+        (const arena_block_t *) ((size_t) p - sizeof(arena_block_t));
+    return b->magic_header == MAGICARENA ? b->arena : NULL;
+}
+
+/* Return single arena block to its freelist, or leave it to arena_free if it
+ * is too large to be recycled
+ */
+static void arena_release(void *p)
+{
+    arena_block_t *b = (arena_block_t *) ((size_t) p - sizeof(arena_block_t));
+    arena_t *arena = b->arena;
+    size_t cls = arena_capacity(b->payload_size) / sizeof(void *);
+
+    b->magic_header = MAGICFREE;
+    memset(p, FILLCHAR, b->payload_size);
+    if (cls <= ARENA_CLASSES) {
+        *(void **) p = arena->freelist[cls];
+        arena->freelist[cls] = p;
+    }
+}
+
 size_t allocation_check()
 {
-    return allocated_count;
+    size_t count = 0;
+    acquire(&shards_lock);
+    for (shard_t *shard = shards; shard; shard = shard->next) {
+        acquire(&shard->lock);
+        count += shard->allocated_count;
+        release(&shard->lock);
+    }
+    release(&shards_lock);
+    return count;
+}
+
+void allocation_stats(alloc_stats_t *stats)
+{
+    memset(stats, 0, sizeof(alloc_stats_t));
+    acquire(&shards_lock);
+    for (shard_t *shard = shards; shard; shard = shard->next) {
+        acquire(&shard->lock);
+        stats->blocks += shard->allocated_count;
+        stats->payload_bytes += shard->payload_bytes;
+        stats->harness_bytes += shard->harness_bytes;
+        stats->allocator_bytes += shard->allocator_bytes;
+        release(&shard->lock);
+    }
+    release(&shards_lock);
+    stats->peak_bytes = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+}
+
+bool block_stats(const void *p, alloc_stats_t *stats)
+{
+    if (!p)
+        return false;
+    if (arena_of(p)) {
+        /* Arena chunks are accounted as ordinary blocks */
+        const arena_block_t *ab =
+            (const arena_block_t *) ((size_t) p - sizeof(arena_block_t));
+        stats->blocks++;
+        stats->payload_bytes += ab->payload_size;
+        stats->harness_bytes += sizeof(arena_block_t) +
+                                arena_capacity(ab->payload_size) -
+                                ab->payload_size;
+        return true;
+    }
+
+    block_element_t *b =
+        (block_element_t *) ((size_t) p - sizeof(block_element_t));
+    if (b->magic_header != MAGICHEADER && b->magic_header != MAGICGUARD)
+        return false;
+
+    size_t harness, allocator;
+    block_cost(b, &harness, &allocator);
+    stats->blocks++;
+    stats->payload_bytes += b->payload_size;
+    stats->harness_bytes += harness;
+    stats->allocator_bytes += allocator;
+    return true;
 }
 
 /* Implementation of functions for testing */
@@ -258,12 +836,121 @@ void set_noallocate_mode(bool noallocate)
     noallocate_mode = noallocate;
 }
 
+/* Start a new fault injection schedule, with harness_lock held */
+static void fault_reset(fault_mode_t mode)
+{
+    fault_mode = mode;
+    fault_index = 0;
+    fault_log_len = 0;
+    fault_log_lost = false;
+    free(fault_list);
+    fault_list = NULL;
+    fault_list_len = fault_list_pos = 0;
+}
+
+void fault_schedule_random()
+{
+    acquire(&harness_lock);
+    fault_reset(FAULT_RANDOM);
+    release(&harness_lock);
+}
+
+void fault_schedule_every(size_t n)
+{
+    acquire(&harness_lock);
+    fault_reset(FAULT_EVERY);
+    fault_every = fault_countdown = n;
+    release(&harness_lock);
+}
+
+static int cmp_index(const void *a, const void *b)
+{
+    size_t x = *(const size_t *) a, y = *(const size_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Install a sorted list of indices, with harness_lock held */
+static void fault_install(size_t *list, size_t n)
+{
+    fault_reset(FAULT_LIST);
+    fault_list = list;
+    fault_list_len = n;
+}
+
+bool fault_schedule_list(const size_t *idx, size_t n)
+{
+    size_t *list = malloc((n ? n : 1) * sizeof(size_t));
+    if (!list)
+        return false;
+    memcpy(list, idx, n * sizeof(size_t));
+    qsort(list, n, sizeof(size_t), cmp_index);
+
+    acquire(&harness_lock);
+    fault_install(list, n);
+    release(&harness_lock);
+    return true;
+}
+
+void fault_schedule_rate(int percent, uint64_t seed)
+{
+    acquire(&harness_lock);
+    fault_reset(FAULT_RATE);
+    fault_percent = percent;
+    fault_seed = fault_state = seed;
+    fault_threshold = percent >= 100 ? UINT64_MAX
+                                     : (UINT64_MAX / 100) * (uint64_t) percent;
+    release(&harness_lock);
+}
+
+bool fault_schedule_replay()
+{
+    size_t *list = malloc(FAULT_LOG_MAX * sizeof(size_t));
+    if (!list)
+        return false;
+
+    acquire(&harness_lock);
+    if (fault_log_lost)
+        report(1, "Warning: only the first %d failures can be replayed",
+               FAULT_LOG_MAX);
+    /* The log is already in ascending order */
+    size_t n = fault_log_len;
+    memcpy(list, fault_log, n * sizeof(size_t));
+    fault_install(list, n);
+    release(&harness_lock);
+    return true;
+}
+
+void fault_schedule_show()
+{
+    acquire(&harness_lock);
+    switch (fault_mode) {
+    case FAULT_RANDOM:
+        report(1, "Fault schedule: random, %d%% (not reproducible)",
+               fail_probability);
+        break;
+    case FAULT_EVERY:
+        report(1, "Fault schedule: every %lu allocations", fault_every);
+        break;
+    case FAULT_LIST:
+        report(1, "Fault schedule: %lu listed allocations", fault_list_len);
+        break;
+    case FAULT_RATE:
+        report(1, "Fault schedule: rate %d%%, seed %llu", fault_percent,
+               (unsigned long long) fault_seed);
+        break;
+    }
+
+    report_noreturn(1, "Allocations: %lu, failed:", fault_index);
+    for (size_t i = 0; i < fault_log_len; i++)
+        report_noreturn(1, " %lu", fault_log[i]);
+    report(1, fault_log_lost ? " ..." : "");
+    release(&harness_lock);
+}
+
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    return atomic_exchange(&error_occurred, false);
 }
 
 /* Prepare for a risky operation using setjmp.
@@ -316,3 +1003,12 @@ void trigger_exception(char *msg)
     else
         exit(1);
 }
+
+/* Same, from a signal handler, once no harness lock is held */
+void signal_exception(char *msg)
+{
+    if (locks_held)
+        deferred_exception = msg;
+    else
+        trigger_exception(msg);
+}
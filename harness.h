@@ -4,10 +4,14 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
  * allow checking for common allocation errors.
+ *
+ * The allocator is thread-safe, so concurrent queue code can be tested with
+ * the same leak and corruption checks.
  */
 
 void *test_malloc(size_t size);
@@ -16,14 +20,83 @@ void test_free(void *p);
 char *test_strdup(const char *s);
 /* FIXME: provide test_realloc as well */
 
+/*
+ * Arenas hand out blocks bump-allocated from a few large harness blocks, and
+ * release them all at once with arena_free. test_free on a single arena block
+ * puts it on a freelist of its arena for reuse. An arena must only be used by
+ * one thread at a time.
+ */
+typedef struct __arena arena_t;
+
+arena_t *arena_new();
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *s);
+void arena_free(arena_t *arena);
+
+/* Return the arena block p was allocated from, NULL if not an arena block */
+arena_t *arena_of(const void *p);
+
 #ifdef INTERNAL
 
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Memory accounting of allocated blocks */
+typedef struct {
+    size_t blocks;
+    size_t payload_bytes;   /* Requested by callers */
+    size_t harness_bytes;   /* Headers, footers and guard pages */
+    size_t allocator_bytes; /* Estimated system allocator overhead */
+    size_t peak_bytes;      /* Largest total footprint seen so far */
+} alloc_stats_t;
+
+/* Report accounting of all allocated blocks */
+void allocation_stats(alloc_stats_t *stats);
+
+/* Add the accounting of the block with payload p to stats.
+ * Return false if p does not look like an allocated block.
+ */
+bool block_stats(const void *p, alloc_stats_t *stats);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/*
+ * Nonzero to place each new block against an mprotect'ed guard page, so that
+ * overruns and use-after-free fault immediately instead of being found by the
+ * footer check in test_free. Every block then costs at least two pages.
+ */
+extern int guard_mode;
+
+/* Seconds an operation run under exception_setup(true) may take before it is
+ * aborted, 0 for no limit
+ */
+extern int time_limit;
+
+/*
+ * Deterministic fault injection.
+ * Allocation attempts are numbered from 1 since the schedule was last set,
+ * and the index of every injected failure is logged.
+ */
+
+/* Fail at random with fail_probability percent (the default) */
+void fault_schedule_random();
+
+/* Fail every nth allocation */
+void fault_schedule_every(size_t n);
+
+/* Fail the allocations whose indices are listed */
+bool fault_schedule_list(const size_t *idx, size_t n);
+
+/* Fail with percent probability, drawn from a generator seeded with seed */
+void fault_schedule_rate(int percent, uint64_t seed);
+
+/* Rerun exactly the failures logged so far, as a listed schedule */
+bool fault_schedule_replay();
+
+/* Report current schedule and logged failures */
+void fault_schedule_show();
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -41,6 +114,10 @@ bool error_check();
 
 /* Prepare for a risky operation using setjmp.
  * Function returns true for initial return, false for error return
+ *
+ * Each thread has an exception context of its own. The time limit relies on
+ * a process-wide alarm, so other threads must block SIGALRM while one thread
+ * runs time-limited code.
  */
 bool exception_setup(bool limit_time);
 
@@ -51,6 +128,11 @@ void exception_cancel();
  */
 void trigger_exception(char *msg);
 
+/* Same, from a signal handler: while the thread holds a harness lock, the
+ * jump waits until the lock is released
+ */
+void signal_exception(char *msg);
+
 #else /* !INTERNAL */
 
 /* Tested program use our versions of malloc and free */
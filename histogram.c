@@ -0,0 +1,62 @@
+#include <string.h>
+
+#include "histogram.h"
+
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+
+void hist_init(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/* Values of bucket s * HIST_HALF + m, m in [HIST_HALF, 2 * HIST_HALF), are
+ * those with v >> s == m.  Bucket v < 2^HIST_SUB_BITS holds v alone.
+ */
+static size_t bucket_of(uint64_t v)
+{
+    if (v < 2 * HIST_HALF)
+        return v;
+    if (v >> HIST_MAX_BITS)
+        return HIST_BUCKETS - 1;
+    int msb = 63 - __builtin_clzll(v);
+    int s = msb - HIST_SUB_BITS + 1;
+    return ((size_t) s << (HIST_SUB_BITS - 1)) + (v >> s);
+}
+
+/* Middle of the values held by bucket i */
+static uint64_t bucket_value(size_t i)
+{
+    if (i < 2 * HIST_HALF)
+        return i;
+    size_t s = (i >> (HIST_SUB_BITS - 1)) - 1;
+    uint64_t m = i - (s << (HIST_SUB_BITS - 1));
+    return (m << s) + ((1ull << s) >> 1);
+}
+
+void hist_record(histogram_t *h, uint64_t v)
+{
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+    h->buckets[bucket_of(v)]++;
+}
+
+uint64_t hist_percentile(const histogram_t *h, double p)
+{
+    if (!h->count)
+        return 0;
+
+    uint64_t rank = (uint64_t) (p * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = bucket_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,33 @@
+#ifndef LAB0_HISTOGRAM_H
+#define LAB0_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Log-linear histogram in the style of HdrHistogram.  Values below
+ * 2^HIST_SUB_BITS are counted exactly; above that, every power of 2 is
+ * split into 2^(HIST_SUB_BITS - 1) equal buckets, so a value is known to
+ * within 1/64 of itself.  Values of 2^HIST_MAX_BITS and more share the last
+ * bucket.
+ */
+#define HIST_SUB_BITS 7
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS \
+    ((HIST_MAX_BITS - HIST_SUB_BITS + 2) << (HIST_SUB_BITS - 1))
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+void hist_init(histogram_t *h);
+void hist_record(histogram_t *h, uint64_t v);
+
+/* Smallest recorded value v such that a fraction p of the values are at
+ * most v, to within the bucket precision.  0 if nothing was recorded.
+ */
+uint64_t hist_percentile(const histogram_t *h, double p);
+
+#endif /* LAB0_HISTOGRAM_H */
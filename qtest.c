@@ -19,14 +19,19 @@
 #include <time.h>
 #endif
 
+#include "dudect/complexity.h"
+#include "dudect/cpucycles.h"
+#include "dudect/export.h"
 #include "dudect/fixture.h"
 #include "list.h"
 #include "random.h"
+#include "record.h"
 
 /* Shannon entropy */
 extern double shannon_entropy(const uint8_t *input_data);
 extern int show_entropy;
 extern bool q_shuffle(struct list_head *head);
+extern struct list_head *q_new_arena();
 
 /* Our program needs to use regular malloc/free */
 #define INTERNAL 1
@@ -79,6 +84,18 @@ static int descend = 0;
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+
+/* Strings that ih and it generate for RAND, by the kind named after n */
+typedef enum {
+    KEYS_RAND,   /* random lowercase letters */
+    KEYS_SEQ,    /* zero-padded numbers, increasing across commands */
+    KEYS_FEW,    /* one of FEW_KEYS distinct strings */
+    KEYS_PREFIX, /* random letters behind a long prefix common to all */
+} keys_t;
+static const char *const keys_names[] = {"rand", "seq", "few", "prefix"};
+#define FEW_KEYS 16
+#define KEY_PREFIX_LEN 64
+#define MAX_KEY_LEN (KEY_PREFIX_LEN + MAX_RANDSTR_LEN)
 /* For queue_insert and queue_remove */
 typedef enum {
     POS_TAIL,
@@ -141,8 +158,9 @@ static bool do_free(int argc, char *argv[])
 
 static bool do_new(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    bool use_arena = argc == 2 && !strcmp(argv[1], "arena");
+    if (argc != 1 && !use_arena) {
+        report(1, "%s takes no arguments other than 'arena'", argv[0]);
         return false;
     }
 
@@ -153,7 +171,7 @@ static bool do_new(int argc, char *argv[])
         list_add_tail(&qctx->chain, &chain.head);
 
         qctx->size = 0;
-        qctx->q = q_new();
+        qctx->q = use_arena ? q_new_arena() : q_new();
         qctx->id = chain.size++;
 
         current = qctx;
@@ -181,16 +199,56 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
-/* insertion */
-static bool queue_insert(position_t pos, int argc, char *argv[])
+static bool keys_kind(const char *s, keys_t *keys)
 {
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
+    for (size_t i = 0; i < sizeof(keys_names) / sizeof(keys_names[0]); i++) {
+        if (!strcmp(s, keys_names[i])) {
+            *keys = i;
+            return true;
         }
-        bool ok =
-            pos == POS_TAIL ? is_insert_tail_const() : is_insert_head_const();
+    }
+    return false;
+}
+
+/* Generate the next string of the given kind into buf[MAX_KEY_LEN] */
+static void fill_key(keys_t keys, char *buf)
+{
+    static unsigned long seq = 0;
+
+    switch (keys) {
+    case KEYS_RAND:
+        fill_rand_string(buf, MAX_RANDSTR_LEN);
+        break;
+    case KEYS_SEQ:
+        snprintf(buf, MAX_KEY_LEN, "%012lu", seq++);
+        break;
+    case KEYS_FEW:
+        snprintf(buf, MAX_KEY_LEN, "few%02d", rand() % FEW_KEYS);
+        break;
+    case KEYS_PREFIX:
+        memset(buf, 'p', KEY_PREFIX_LEN);
+        fill_rand_string(buf + KEY_PREFIX_LEN, MAX_RANDSTR_LEN);
+        break;
+    }
+}
+
+/* Check the command's operation against its expected complexity, as listed
+ * in DUT_FUNCS, instead of running it
+ */
+static bool simulate(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+
+    int mode = dut_find(argv[0]);
+    complexity_t expected = dut_complexity(mode);
+    set_cautious_mode(false);
+    bool ok = dut_check(mode);
+    set_cautious_mode(true);
+
+    if (expected == COMPLEXITY_1) {
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -200,17 +258,33 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         return ok;
     }
 
+    if (!ok) {
+        report(1, "ERROR: Probably slower than %s or wrong implementation",
+               complexity_name(expected));
+        return false;
+    }
+    report(1, "Probably %s", complexity_name(expected));
+    return ok;
+}
+
+/* insertion */
+static bool queue_insert(position_t pos, int argc, char *argv[])
+{
+    if (simulation)
+        return simulate(argc, argv);
+
     char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
+    char key_buf[MAX_KEY_LEN];
     int reps = 1;
+    keys_t keys = KEYS_RAND;
     bool ok = true, need_rand = false;
-    if (argc != 2 && argc != 3) {
-        report(1, "%s needs 1-2 arguments", argv[0]);
+    if (argc < 2 || argc > 4) {
+        report(1, "%s needs 1-3 arguments", argv[0]);
         return false;
     }
 
     char *inserts = argv[1];
-    if (argc == 3) {
+    if (argc >= 3) {
         if (!get_int(argv[2], &reps) || reps < 1) {
             report(1, "Invalid number of insertions '%s'", argv[2]);
             return false;
@@ -219,7 +293,14 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
 
     if (!strcmp(inserts, "RAND")) {
         need_rand = true;
-        inserts = randstr_buf;
+        inserts = key_buf;
+        if (argc == 4 && !keys_kind(argv[3], &keys)) {
+            report(1, "Unknown kind of strings '%s'", argv[3]);
+            return false;
+        }
+    } else if (argc == 4) {
+        report(1, "A kind of strings only applies to RAND");
+        return false;
     }
 
     if (!current || !current->q)
@@ -230,7 +311,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+                fill_key(keys, key_buf);
             bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
                                         : q_insert_head(current->q, inserts);
             if (rval) {
@@ -291,26 +372,13 @@ static bool do_it(int argc, char *argv[])
 
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
-    /* FIXME: It is known that both functions is_remove_tail_const() and
-     * is_remove_head_const() can not pass dudect on Apple M1 (based on Arm64).
+    /* FIXME: It is known that both remove_head and remove_tail can not pass
+     * dudect on Apple M1 (based on Arm64).
      * We shall figure out the exact reasons and resolve later.
      */
 #if !(defined(__aarch64__) && defined(__APPLE__))
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok =
-            pos == POS_TAIL ? is_remove_tail_const() : is_remove_head_const();
-        if (!ok) {
-            report(1,
-                   "ERROR: Probably not constant time or wrong implementation");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation)
+        return simulate(argc, argv);
 #endif
 
     if (argc != 1 && argc != 2) {
@@ -463,10 +531,14 @@ static bool do_dedup(int argc, char *argv[])
         }
     }
 
+    /* Checking each freed block against all allocated ones is quadratic */
+    if (current->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
     bool ok = true;
     if (exception_setup(true))
         ok = q_delete_dup(current->q);
     exception_cancel();
+    set_cautious_mode(true);
 
     if (!ok) {
         list_for_each_entry_safe(item, tmp, &l_copy, list) {
@@ -515,6 +587,9 @@ static bool do_dedup(int argc, char *argv[])
 
 static bool do_reverse(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate(argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -536,6 +611,9 @@ static bool do_reverse(int argc, char *argv[])
 
 static bool do_size(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate(argc, argv);
+
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
@@ -577,6 +655,30 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Position of a node in the queue before sorting, looked up by address */
+typedef struct {
+    struct list_head *node;
+    unsigned pos;
+} node_pos_t;
+
+static int node_pos_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) ((const node_pos_t *) a)->node;
+    uintptr_t y = (uintptr_t) ((const node_pos_t *) b)->node;
+    return (x > y) - (x < y);
+}
+
+/* Position of node among the n entries sorted by address, n if absent */
+static unsigned node_pos(const node_pos_t *nodes,
+                         unsigned n,
+                         struct list_head *node)
+{
+    node_pos_t key = {node, 0};
+    const node_pos_t *found =
+        bsearch(&key, nodes, n, sizeof(node_pos_t), node_pos_cmp);
+    return found ? found->pos : n;
+}
+
 bool do_sort(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -601,12 +703,16 @@ bool do_sort(int argc, char *argv[])
  * stability of the sort. So, MAX_NODES is used to limit the number of elements
  * to check the stability of the sort. */
 #define MAX_NODES 100000
-    struct list_head *nodes[MAX_NODES];
+    static node_pos_t nodes[MAX_NODES];
     unsigned no = 0;
+    bool indexed = false;
     if (current && current->size && current->size <= MAX_NODES) {
         element_t *entry;
-        list_for_each_entry(entry, current->q, list)
-            nodes[no++] = &entry->list;
+        list_for_each_entry(entry, current->q, list) {
+            nodes[no].node = &entry->list;
+            nodes[no].pos = no;
+            no++;
+        }
     } else if (current && current->size > MAX_NODES)
         report(1,
                "Warning: Skip checking the stability of the sort because the "
@@ -640,17 +746,13 @@ bool do_sort(int argc, char *argv[])
             /* Ensure the stability of the sort */
             if (current->size <= MAX_NODES &&
                 !strcmp(item->value, next_item->value)) {
-                bool unstable = false;
-                for (unsigned i = 0; i < MAX_NODES; i++) {
-                    if (nodes[i] == cur_l->next) {
-                        unstable = true;
-                        break;
-                    }
-                    if (nodes[i] == cur_l) {
-                        break;
-                    }
+                /* Index the original order on the first duplicate */
+                if (!indexed) {
+                    qsort(nodes, no, sizeof(node_pos_t), node_pos_cmp);
+                    indexed = true;
                 }
-                if (unstable) {
+                if (node_pos(nodes, no, cur_l->next) <
+                    node_pos(nodes, no, cur_l)) {
                     report(
                         1,
                         "ERROR: Not stable sort. The duplicate strings \"%s\" "
@@ -670,6 +772,9 @@ bool do_sort(int argc, char *argv[])
 
 static bool do_dm(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate(argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -696,6 +801,9 @@ static bool do_dm(int argc, char *argv[])
 
 static bool do_swap(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate(argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -740,8 +848,11 @@ static bool do_ascend(int argc, char *argv[])
         report(3, "Warning: Calling ascend on single node");
     error_check();
 
+    if (current->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
     if (exception_setup(true))
         current->size = q_ascend(current->q);
+    set_cautious_mode(true);
     set_noallocate_mode(false);
 
     bool ok = true;
@@ -787,8 +898,11 @@ static bool do_descend(int argc, char *argv[])
         report(3, "Warning: Calling descend on single node");
     error_check();
 
+    if (current->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
     if (exception_setup(true))
         current->size = q_descend(current->q);
+    set_cautious_mode(true);
     set_noallocate_mode(false);
 
     bool ok = true;
@@ -856,6 +970,19 @@ static bool do_merge(int argc, char *argv[])
     }
     error_check();
 
+    /* Merging moves elements between queues, which would leave them in an
+     * arena that is released along with its emptied queue.
+     */
+    if (chain.size > 1) {
+        queue_contex_t *ctx;
+        list_for_each_entry(ctx, &chain.head, chain) {
+            if (arena_of(ctx->q)) {
+                report(1, "ERROR: Cannot merge a chain holding arena queues");
+                return false;
+            }
+        }
+    }
+
     int len = 0;
     set_noallocate_mode(true);
     if (current && exception_setup(true))
@@ -923,6 +1050,138 @@ static bool do_shuffle(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Add the accounting of the head and the elements of a queue to stats.
+ * Return the number of elements.
+ */
+static size_t queue_stats(queue_contex_t *ctx, alloc_stats_t *stats)
+{
+    size_t n = 0;
+    if (!ctx->q)
+        return 0;
+
+    block_stats(ctx->q, stats);
+    element_t *e;
+    list_for_each_entry(e, ctx->q, list) {
+        block_stats(e, stats);
+        block_stats(e->value, stats);
+        n++;
+    }
+    return n;
+}
+
+static void report_stats(const char *name, size_t n, const alloc_stats_t *st)
+{
+    size_t total = st->payload_bytes + st->harness_bytes + st->allocator_bytes;
+    report(1, "%s: %lu elements in %lu blocks", name, n, st->blocks);
+    report(1, "  payload    %12lu bytes", st->payload_bytes);
+    report(1, "  harness    %12lu bytes", st->harness_bytes);
+    report(1, "  allocator  %12lu bytes (estimated)", st->allocator_bytes);
+    if (n)
+        report(1, "  total      %12lu bytes (%.1f bytes/element)", total,
+               (double) total / n);
+    else
+        report(1, "  total      %12lu bytes", total);
+}
+
+static bool do_memstat(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    alloc_stats_t st = {0};
+    size_t n;
+    if (current) {
+        n = queue_stats(current, &st);
+        char name[32];
+        snprintf(name, sizeof(name), "Queue %d", current->id);
+        report_stats(name, n, &st);
+    } else {
+        report(3, "Warning: There is no current queue");
+    }
+
+    memset(&st, 0, sizeof(st));
+    n = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry(ctx, &chain.head, chain)
+        n += queue_stats(ctx, &st);
+    char name[32];
+    snprintf(name, sizeof(name), "Chain of %d queues", chain.size);
+    report_stats(name, n, &st);
+
+    allocation_stats(&st);
+    report(1, "All blocks: %lu blocks, %lu bytes, peak %lu bytes", st.blocks,
+           st.payload_bytes + st.harness_bytes + st.allocator_bytes,
+           st.peak_bytes);
+    report(1, "Interpreter: %lu bytes, peak %lu bytes",
+           current_allocated_bytes(), peak_allocated_bytes());
+    return true;
+}
+
+static bool do_fault(int argc, char *argv[])
+{
+    if (argc == 1) {
+        fault_schedule_show();
+        return true;
+    }
+
+    const char *mode = argv[1];
+    if (!strcmp(mode, "off") && argc == 2) {
+        fault_schedule_random();
+    } else if (!strcmp(mode, "every") && argc == 3) {
+        int n;
+        if (!get_int(argv[2], &n) || n < 1) {
+            report(1, "Invalid allocation interval '%s'", argv[2]);
+            return false;
+        }
+        fault_schedule_every(n);
+    } else if (!strcmp(mode, "at") && argc > 2) {
+        size_t *idx = malloc_or_fail((argc - 2) * sizeof(size_t), "do_fault");
+        for (int i = 2; i < argc; i++) {
+            int n;
+            if (!get_int(argv[i], &n) || n < 1) {
+                report(1, "Invalid allocation index '%s'", argv[i]);
+                free_block(idx, (argc - 2) * sizeof(size_t));
+                return false;
+            }
+            idx[i - 2] = n;
+        }
+        bool ok = fault_schedule_list(idx, argc - 2);
+        free_block(idx, (argc - 2) * sizeof(size_t));
+        if (!ok)
+            return false;
+    } else if (!strcmp(mode, "rate") && (argc == 3 || argc == 4)) {
+        int percent;
+        if (!get_int(argv[2], &percent) || percent < 0 || percent > 100) {
+            report(1, "Invalid failure percent '%s'", argv[2]);
+            return false;
+        }
+        uint64_t seed;
+        if (argc == 4) {
+            char *end = NULL;
+            seed = strtoull(argv[3], &end, 0);
+            if (*end != '\0') {
+                report(1, "Invalid seed '%s'", argv[3]);
+                return false;
+            }
+        } else {
+            randombytes((uint8_t *) &seed, sizeof(seed));
+        }
+        fault_schedule_rate(percent, seed);
+    } else if (!strcmp(mode, "replay") && argc == 2) {
+        if (!fault_schedule_replay())
+            return false;
+    } else {
+        report(1, "Usage: fault [off | every N | at I ... | rate P [SEED] | "
+                  "replay]");
+        return false;
+    }
+
+    fault_schedule_show();
+    return true;
+}
+
 static bool is_circular()
 {
     struct list_head *cur = current->q->next;
@@ -1066,20 +1325,157 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+static bool do_complexity(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s takes 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    const complexity_op_t *op = complexity_find(argv[1]);
+    if (!op) {
+        report(1, "Unknown operation '%s', choose one of: %s", argv[1],
+               complexity_ops());
+        return false;
+    }
+
+    complexity_t expected = COMPLEXITY_NR;
+    if (argc == 3 && !complexity_parse(argv[2], &expected)) {
+        report(1, "Invalid complexity '%s', choose one of: 1 logn n nlogn n2",
+               argv[2]);
+        return false;
+    }
+
+    /* Inputs are far beyond BIG_LIST_SIZE */
+    complexity_result_t res;
+    set_cautious_mode(false);
+    bool ok = complexity_estimate(op, &res);
+    set_cautious_mode(true);
+    if (!ok) {
+        report(1, "ERROR: Could not time %s over enough queue sizes", op->name);
+        return false;
+    }
+
+    for (size_t i = 0; i < res.points; i++)
+        report(3, "  n = %7lu: %12.0f ns", res.n[i], res.ns[i]);
+    for (int c = 0; c < COMPLEXITY_NR; c++)
+        report(3, "  %-10s misfit %.3f", complexity_name(c), res.misfit[c]);
+    report(1, "%s: %s, confidence %.2f", op->name, complexity_name(res.best),
+           res.confidence);
+
+    if (expected != COMPLEXITY_NR && !complexity_within(&res, expected)) {
+        report(1, "ERROR: Expected %s but %s grows as %s",
+               complexity_name(expected), op->name, complexity_name(res.best));
+        return false;
+    }
+    return true;
+}
+
+static bool do_export(int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        export_close();
+        return true;
+    }
+
+    export_format_t format = EXPORT_CSV;
+    if (argc == 3 && !strcmp(argv[2], "bin")) {
+        format = EXPORT_BINARY;
+    } else if (argc != 2 && (argc != 3 || strcmp(argv[2], "csv"))) {
+        report(1, "Usage: export FILE [csv|bin] | export off");
+        return false;
+    }
+    return export_open(argv[1], format);
+}
+
+/* Allocation accounting after the last recorded command */
+static alloc_stats_t record_last;
+
+static void record_hook(int argc, char *argv[], uint64_t ns, bool ok)
+{
+    alloc_stats_t now;
+    allocation_stats(&now);
+    record_command(argc, argv, ns, ok,
+                   (long) now.blocks - (long) record_last.blocks,
+                   (long) now.payload_bytes - (long) record_last.payload_bytes,
+                   current && current->q ? current->size : -1);
+    record_last = now;
+}
+
+static bool start_record(const char *path, record_format_t format)
+{
+    if (!record_open(path, format))
+        return false;
+    allocation_stats(&record_last);
+    set_cmd_hook(record_hook);
+    return true;
+}
+
+static void stop_record(void)
+{
+    set_cmd_hook(NULL);
+    record_close();
+}
+
+static bool do_record(int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        stop_record();
+        return true;
+    }
+
+    record_format_t format = RECORD_CSV;
+    if (argc == 3 && !strcmp(argv[2], "json")) {
+        format = RECORD_JSON;
+    } else if (argc != 2 && (argc != 3 || strcmp(argv[2], "csv"))) {
+        report(1, "Usage: record FILE [csv|json] | record off");
+        return false;
+    }
+    return start_record(argv[1], format);
+}
+
+static void timer_setter(int oldval)
+{
+    cpucycles_select(cpucycles_backend);
+}
+
+static void workers_setter(int oldval)
+{
+    if (dudect_workers < 1) {
+        report(1, "Number of workers must be at least 1");
+        dudect_workers = oldval;
+    }
+}
+
+static void noise_setter(int oldval)
+{
+    if (dudect_noise < NOISE_IGNORE || dudect_noise > NOISE_DROP) {
+        report(1, "Noise handling must be between %d and %d", NOISE_IGNORE,
+               NOISE_DROP);
+        dudect_noise = oldval;
+    }
+}
+
 static void console_init()
 {
-    ADD_COMMAND(new, "Create new queue", "");
+    ADD_COMMAND(new,
+                "Create new queue. Allocate its elements from an arena if "
+                "'arena' is given",
+                "[arena]");
     ADD_COMMAND(free, "Delete queue", "");
     ADD_COMMAND(prev, "Switch to previous queue", "");
     ADD_COMMAND(next, "Switch to next queue", "");
     ADD_COMMAND(ih,
                 "Insert string str at head of queue n times. Generate random "
-                "string(s) if str equals RAND. (default: n == 1)",
-                "str [n]");
+                "string(s) if str equals RAND, of the given kind: rand, seq "
+                "for increasing numbers, few for one of 16 strings, or prefix "
+                "for random strings behind a common 64-character prefix. "
+                "(default: n == 1, kind == rand)",
+                "str [n [kind]]");
     ADD_COMMAND(it,
-                "Insert string str at tail of queue n times. Generate random "
-                "string(s) if str equals RAND. (default: n == 1)",
-                "str [n]");
+                "Insert string str at tail of queue n times. Generate strings "
+                "for RAND as ih does. (default: n == 1, kind == rand)",
+                "str [n [kind]]");
     ADD_COMMAND(
         rh,
         "Remove from head of queue. Optionally compare to expected value str",
@@ -1109,14 +1505,55 @@ static void console_init()
     ADD_COMMAND(
         shuffle,
         "Use Fisher_Yates algorithm shuffle to shuffle the nodes in queue", "");
+    ADD_COMMAND(memstat,
+                "Show memory footprint and bytes per element of current queue "
+                "and whole chain",
+                "");
+    ADD_COMMAND(fault,
+                "Show or set the malloc failure schedule: fail every Nth, "
+                "the listed, or P percent of allocations from SEED; replay "
+                "the failures logged so far",
+                "[off|every N|at I ...|rate P [SEED]|replay]");
+    ADD_COMMAND(complexity,
+                "Estimate how the running time of an operation grows with "
+                "the queue size; fail if it grows faster than expected",
+                "op [1|logn|n|nlogn|n2]");
+    ADD_COMMAND(export,
+                "Write raw (class, ticks) measurements of simulation mode to "
+                "FILE as CSV or binary records, or stop writing them",
+                "FILE [csv|bin] | off");
+    ADD_COMMAND(record,
+                "Write the name, arguments, duration, allocation changes and "
+                "resulting queue size of every command to FILE as CSV or JSON "
+                "lines, or stop writing them",
+                "FILE [csv|json] | off");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("guard", &guard_mode,
+              "Place blocks against guard pages to trap overruns", NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("time", &time_limit,
+              "Seconds a queue operation may run, 0 for no limit", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("timer", &cpucycles_backend,
+              "Simulation timer: 0 rdtsc, 1 rdtscp+lfence, 2 monotonic clock, "
+              "3 perf cycles, 4 perf instructions",
+              timer_setter);
+    add_param("workers", &dudect_workers,
+              "Number of CPU-pinned threads measuring in simulation mode",
+              workers_setter);
+    add_param("sequential", &dudect_sequential,
+              "Stop simulation tests once a sequential test settles them "
+              "(single worker only)",
+              NULL);
+    add_param("noise", &dudect_noise,
+              "Batches disturbed by interrupts or CPU frequency changes in "
+              "simulation mode: 0 ignored, 1 counted, 2 measured again",
+              noise_setter);
 }
 
 /* Signal handlers */
@@ -1133,7 +1570,7 @@ static void sigsegv_handler(int sig)
 
 static void sigalrm_handler(int sig)
 {
-    trigger_exception(
+    signal_exception(
         "Time limit exceeded.  Either you are in an infinite loop, or your "
         "code is too inefficient");
 }
@@ -1148,6 +1585,8 @@ static void q_init()
 
 static bool q_quit(int argc, char *argv[])
 {
+    export_close();
+    stop_record();
     report(3, "Freeing queue");
     if (current && current->size > BIG_LIST_SIZE)
         set_cautious_mode(false);
@@ -1179,10 +1618,19 @@ static bool q_quit(int argc, char *argv[])
 static void usage(char *cmd)
 {
     printf("Usage: %s [-h] [-f FILE][-v LEVEL][-l LOG\n", cmd);
+    printf("       %s --compile FILE -o OUT\n", cmd);
+    printf("       %s --batch [-f FILE][-v LEVEL]\n", cmd);
+    printf("       %s --record FILE [-f FILE][-v LEVEL]\n", cmd);
     printf("\t-h         Print this information\n");
     printf("\t-f FILE   Read commands from FILE\n");
     printf("\t-v LEVEL  Set verbosity level\n");
     printf("\t-l LOG    Echo results to LOG\n");
+    printf("\t--compile FILE -o OUT  Compile the commands of FILE to OUT, "
+           "which -f and source run without parsing\n");
+    printf("\t--batch   Run without showing the queue after each command, "
+           "buffer output, and end with a summary; LEVEL defaults to 1\n");
+    printf("\t--record FILE  Write one record per command to FILE, as JSON "
+           "lines if it ends in .json or .jsonl and as CSV otherwise\n");
     exit(0);
 }
 
@@ -1389,10 +1837,22 @@ int main(int argc, char *argv[])
     char *infile_name = NULL;
     char lbuf[BUFSIZE];
     char *logfile_name = NULL;
+    char *compile_name = NULL;
+    char *out_name = NULL;
+    char *record_name = NULL;
     int level = 4;
+    bool level_set = false, batch = false;
     int c;
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    static const struct option long_options[] = {
+        {"compile", required_argument, NULL, 'c'},
+        {"batch", no_argument, NULL, 'b'},
+        {"record", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((c = getopt_long(argc, argv, "hv:f:l:o:", long_options, NULL)) !=
+           -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -1410,6 +1870,7 @@ int main(int argc, char *argv[])
                 fprintf(stderr, "Invalid verbosity level\n");
                 exit(EXIT_FAILURE);
             }
+            level_set = true;
             break;
         }
         case 'l':
@@ -1417,6 +1878,18 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
+        case 'c':
+            compile_name = optarg;
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        case 'b':
+            batch = true;
+            break;
+        case 'r':
+            record_name = optarg;
+            break;
         default:
             printf("Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -1429,12 +1902,36 @@ int main(int argc, char *argv[])
      */
     srand(os_random(getpid() ^ getppid()));
 
+    if (compile_name) {
+        if (!out_name) {
+            fprintf(stderr, "--compile needs an output file given with -o\n");
+            exit(EXIT_FAILURE);
+        }
+        set_verblevel(level);
+        return !compile_file(compile_name, out_name);
+    }
+
+    /* Queues are only shown at level 3 and up, commands echoed above 1 */
+    if (batch) {
+        set_batch_output();
+        if (!level_set)
+            level = 1;
+    }
+
     q_init();
     init_cmd();
     console_init();
+    set_batch(batch);
+
+    if (record_name) {
+        const char *ext = strrchr(record_name, '.');
+        bool json = ext && (!strcmp(ext, ".json") || !strcmp(ext, ".jsonl"));
+        if (!start_record(record_name, json ? RECORD_JSON : RECORD_CSV))
+            exit(EXIT_FAILURE);
+    }
 
     /* Initialize linenoise only when infile_name not exist */
-    if (!infile_name) {
+    if (!infile_name && !batch) {
         /* Trigger call back function(auto completion) */
         line_set_completion_callback(completion);
 
@@ -21,12 +21,36 @@ struct list_head *q_new()
     return head;
 }
 
+/* Create an empty queue whose elements are allocated from an arena, so that
+ * q_free releases a few arena chunks instead of walking every element.
+ * Elements must not be moved between an arena queue and any other queue.
+ */
+struct list_head *q_new_arena()
+{
+    arena_t *arena = arena_new();
+    if (!arena) {
+        return NULL;
+    }
+    struct list_head *head = arena_alloc(arena, sizeof(struct list_head));
+    if (!head) {
+        arena_free(arena);
+        return NULL;
+    }
+    INIT_LIST_HEAD(head);
+    return head;
+}
+
 /* Free all storage used by queue */
 void q_free(struct list_head *head)
 {
     if (!head) {
         return;
     }
+    arena_t *arena = arena_of(head);
+    if (arena) {
+        arena_free(arena);
+        return;
+    }
     struct list_head *node, *safe;
     list_for_each_safe(node, safe, head) {
         element_t *current_element = list_entry(node, element_t, list);
@@ -35,21 +59,35 @@ void q_free(struct list_head *head)
     free(head);
 }
 
+/* Allocate an element holding a copy of s, from the arena of the queue if it
+ * has one
+ */
+static element_t *alloc_element(struct list_head *head, char *s)
+{
+    arena_t *arena = arena_of(head);
+    element_t *new_element = arena ? arena_alloc(arena, sizeof(element_t))
+                                   : malloc(sizeof(element_t));
+    if (!new_element) {
+        return NULL;
+    }
+    new_element->value = arena ? arena_strdup(arena, s) : strdup(s);
+    if (!new_element->value) {
+        free(new_element);
+        return NULL;
+    }
+    return new_element;
+}
+
 /* Insert an element at head of queue */
 bool q_insert_head(struct list_head *head, char *s)
 {
     if (!head || !s) {
         return false;
     }
-    element_t *new_element = malloc(sizeof(element_t));
+    element_t *new_element = alloc_element(head, s);
     if (!new_element) {
         return false;
     }
-    new_element->value = strdup(s);
-    if (!new_element->value) {
-        free(new_element);
-        return false;
-    }
     list_add(&new_element->list, head);
     return true;
 }
@@ -60,15 +98,10 @@ bool q_insert_tail(struct list_head *head, char *s)
     if (!head || !s) {
         return false;
     }
-    element_t *new_element = malloc(sizeof(element_t));
+    element_t *new_element = alloc_element(head, s);
     if (!new_element) {
         return false;
     }
-    new_element->value = strdup(s);
-    if (!new_element->value) {
-        free(new_element);
-        return false;
-    }
     list_add_tail(&new_element->list, head);
     return true;
 }
@@ -359,10 +392,11 @@ int q_merge(struct list_head *head, bool descend)
     } else if (q_size(head) == 1) {
         return q_size(list_entry(head->next, queue_contex_t, chain)->q);
     }
+    int queues = q_size(head);
     queue_contex_t *node = list_entry(head->next, queue_contex_t, chain);
     node->q->prev->next = NULL;
     struct list_head *nex = node->chain.next;
-    for (int i = 0; i < ((node->size) - 1); i++) {
+    for (int i = 0; i < queues - 1; i++) {
         queue_contex_t *next_node = list_entry(nex, queue_contex_t, chain);
         next_node->q->prev->next = NULL;
         node->q->next =
@@ -0,0 +1,159 @@
+/**
+ * Write one structured record per command to a file.
+ *
+ * Records are gathered in a buffer of RECORD_BUFSIZE bytes and written out
+ * when it fills up or the file is closed, so that recording adds no system
+ * call to most commands.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "record.h"
+#include "report.h"
+
+#define RECORD_BUFSIZE (64 * 1024)
+
+static int record_fd = -1;
+static record_format_t record_format;
+static char record_buf[RECORD_BUFSIZE];
+static size_t record_len = 0;
+
+static bool record_flush(void)
+{
+    size_t done = 0;
+    while (done < record_len) {
+        ssize_t n = write(record_fd, record_buf + done, record_len - done);
+        if (n < 0) {
+            report(1, "ERROR: Could not write records: %s", strerror(errno));
+            record_len = 0;
+            return false;
+        }
+        done += n;
+    }
+    record_len = 0;
+    return true;
+}
+
+/* Make room for len more bytes.  Longer records than the buffer are cut */
+static size_t record_reserve(size_t len)
+{
+    if (record_len + len > RECORD_BUFSIZE)
+        record_flush();
+    return len < RECORD_BUFSIZE ? len : RECORD_BUFSIZE;
+}
+
+static void record_append(const char *data, size_t len)
+{
+    len = record_reserve(len);
+    memcpy(record_buf + record_len, data, len);
+    record_len += len;
+}
+
+static void record_char(char c)
+{
+    record_reserve(1);
+    record_buf[record_len++] = c;
+}
+
+/* Append s as the body of a JSON string or a quoted CSV field */
+static void record_escaped(const char *s)
+{
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (record_format == RECORD_CSV) {
+            if (c == '"')
+                record_char('"');
+            record_char(c);
+        } else if (c == '"' || c == '\\') {
+            record_char('\\');
+            record_char(c);
+        } else if (c < 0x20) {
+            char esc[8];
+            int len = snprintf(esc, sizeof(esc), "\\u%04x", c);
+            record_append(esc, len);
+        } else {
+            record_char(c);
+        }
+    }
+}
+
+static void record_args(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (i > 1)
+            record_char(' ');
+        record_escaped(argv[i]);
+    }
+}
+
+bool record_open(const char *path, record_format_t format)
+{
+    record_close();
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        report(1, "ERROR: Could not open '%s' for writing: %s", path,
+               strerror(errno));
+        return false;
+    }
+
+    record_fd = fd;
+    record_format = format;
+    if (format == RECORD_CSV) {
+        const char header[] = "cmd,args,ns,ok,blocks,bytes,size\n";
+        record_append(header, sizeof(header) - 1);
+    }
+    return true;
+}
+
+void record_close(void)
+{
+    if (record_fd < 0)
+        return;
+    record_flush();
+    close(record_fd);
+    record_fd = -1;
+}
+
+bool record_active(void)
+{
+    return record_fd >= 0;
+}
+
+void record_command(int argc,
+                    char *argv[],
+                    uint64_t ns,
+                    bool ok,
+                    long blocks,
+                    long bytes,
+                    int size)
+{
+    if (record_fd < 0 || argc < 1)
+        return;
+
+    char tail[128];
+    int len;
+    if (record_format == RECORD_CSV) {
+        /* Command names never need quoting */
+        record_append(argv[0], strlen(argv[0]));
+        record_append(",\"", 2);
+        record_args(argc, argv);
+        len = snprintf(tail, sizeof(tail), "\",%llu,%d,%ld,%ld,%d\n",
+                       (unsigned long long) ns, ok, blocks, bytes, size);
+    } else {
+        record_append("{\"cmd\":\"", 8);
+        record_escaped(argv[0]);
+        record_append("\",\"args\":\"", 10);
+        record_args(argc, argv);
+        len = snprintf(tail, sizeof(tail),
+                       "\",\"ns\":%llu,\"ok\":%s,\"blocks\":%ld,"
+                       "\"bytes\":%ld,\"size\":%d}\n",
+                       (unsigned long long) ns, ok ? "true" : "false", blocks,
+                       bytes, size);
+    }
+    record_append(tail, len);
+}
@@ -0,0 +1,35 @@
+#ifndef LAB0_RECORD_H
+#define LAB0_RECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Per-command records for comparing runs.
+ *
+ * Every record holds the command name, its remaining arguments joined by
+ * spaces, its duration in nanoseconds, whether it succeeded, the change in
+ * the number of allocated blocks and payload bytes it caused, and the size
+ * of the current queue afterwards (-1 without one).
+ * CSV files start with a "cmd,args,ns,ok,blocks,bytes,size" header, the
+ * arguments are always quoted.  JSON files hold one object per line with
+ * the same keys.
+ */
+typedef enum { RECORD_CSV, RECORD_JSON } record_format_t;
+
+/* Start recording to path, replacing a file already being written */
+bool record_open(const char *path, record_format_t format);
+
+/* Flush and close the record file, if any */
+void record_close(void);
+
+bool record_active(void);
+
+void record_command(int argc,
+                    char *argv[],
+                    uint64_t ns,
+                    bool ok,
+                    long blocks,
+                    long bytes,
+                    int size);
+
+#endif /* LAB0_RECORD_H */
@@ -19,6 +19,11 @@ static FILE *verbfile = NULL;
 static FILE *logfile = NULL;
 
 int verblevel = 0;
+
+/* Reports are flushed one by one unless output is batched */
+static bool flush_reports = true;
+#define BATCH_BUFSIZE (1 << 20)
+
 static void init_files(FILE *efile, FILE *vfile)
 {
     errfile = efile;
@@ -45,6 +50,14 @@ void set_verblevel(int level)
     verblevel = level;
 }
 
+void set_batch_output(void)
+{
+    if (!verbfile)
+        init_files(stdout, stdout);
+    setvbuf(verbfile, NULL, _IOFBF, BATCH_BUFSIZE);
+    flush_reports = false;
+}
+
 bool set_logfile(const char *file_name)
 {
     logfile = fopen(file_name, "w");
@@ -108,7 +121,8 @@ void report(int level, char *fmt, ...)
         va_start(ap, fmt);
         vfprintf(verbfile, fmt, ap);
         fprintf(verbfile, "\n");
-        fflush(verbfile);
+        if (flush_reports)
+            fflush(verbfile);
         va_end(ap);
 
         if (logfile) {
@@ -140,7 +154,8 @@ void report_noreturn(int level, char *fmt, ...)
         va_list ap;
         va_start(ap, fmt);
         vfprintf(verbfile, fmt, ap);
-        fflush(verbfile);
+        if (flush_reports)
+            fflush(verbfile);
         va_end(ap);
 
         if (logfile) {
@@ -298,6 +313,16 @@ void free_string(char *s)
     free_block((void *) s, strlen(s) + 1);
 }
 
+size_t current_allocated_bytes()
+{
+    return current_bytes;
+}
+
+size_t peak_allocated_bytes()
+{
+    return peak_bytes;
+}
+
 /* Initialization of timers */
 void init_time(double *timep)
 {
@@ -17,6 +17,11 @@ bool set_logfile(const char *file_name);
 extern int verblevel;
 void set_verblevel(int level);
 
+/* Buffer reports in large blocks instead of flushing each one.  Must be
+ * called before anything is printed.
+ */
+void set_batch_output(void);
+
 /* Error messages */
 void report_event(message_t msg, char *fmt, ...);
 
@@ -44,6 +49,12 @@ void free_array(void *b, size_t cnt, size_t bytes);
 /* Free string saved by strsave_or_fail */
 void free_string(char *s);
 
+/* Bytes currently held through the functions above */
+size_t current_allocated_bytes();
+
+/* Largest number of bytes held through the functions above */
+size_t peak_allocated_bytes();
+
 /* Time counted as fp number in seconds */
 void init_time(double *timep);
 
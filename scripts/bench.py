@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+
+# Time the heavy queue operations over growing sizes and key distributions.
+#
+# Every case runs in its own 'qtest --batch' that builds the input, runs the
+# operation once and reports memory use.  The time of the operation is taken
+# from the per-command record qtest writes (see 'qtest --record'), and covers
+# the whole command, including the checks qtest makes of its result.
+
+from __future__ import print_function
+import getopt
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+# Commands inserting n keys of each distribution at the tail of a queue
+dists = {
+    "random": "it RAND %d",
+    "sorted": "it RAND %d seq",
+    "reversed": "ih RAND %d seq",
+    "few": "it RAND %d few",
+    "prefix": "it RAND %d prefix",
+}
+
+ops = ["sort", "merge", "dedup", "reverseK", "shuffle", "ascend", "descend"]
+
+defaultSizes = [10**3, 10**4, 10**5, 10**6, 10**7]
+
+
+class Bench:
+
+    qtest = "./qtest"
+    queues = 8
+    k = 16
+    timeout = 300
+
+    def __init__(self, qtest="", queues=8, k=16, timeout=300):
+        if qtest != "":
+            self.qtest = qtest
+        self.queues = queues
+        self.k = k
+        self.timeout = timeout
+
+    # Commands that build the input of op and run it
+    def script(self, op, dist, n):
+        lines = ["option time 0", "option latency 0"]
+        fill = dists[dist]
+        if op == "merge":
+            # Merging needs sorted queues, so sort each one first
+            for q in range(self.queues):
+                size = n // self.queues + (q < n % self.queues)
+                lines += ["new", fill % size, "sort"]
+        else:
+            lines += ["new", fill % n]
+            if op == "dedup":
+                lines.append("sort")
+        lines.append("reverseK %d" % self.k if op == "reverseK" else op)
+        lines.append("memstat")
+        return "\n".join(lines) + "\n"
+
+    # Run one case.  Returns (ns, peak bytes) and None, or None and the
+    # reason it failed
+    def runCase(self, op, dist, n):
+        fd, rname = tempfile.mkstemp(suffix=".jsonl")
+        os.close(fd)
+        try:
+            proc = subprocess.Popen(
+                [self.qtest, "--batch", "--record", rname],
+                stdin=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                stderr=subprocess.STDOUT)
+            try:
+                out, _ = proc.communicate(
+                    self.script(op, dist, n).encode(), timeout=self.timeout)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+                proc.communicate()
+                return None, "timed out after %d s" % self.timeout
+            out = out.decode(errors="replace")
+            if proc.returncode != 0:
+                lines = [l for l in out.splitlines() if "ERROR" in l]
+                return None, lines[0] if lines else \
+                    "qtest exited with %d" % proc.returncode
+            with open(rname) as f:
+                records = [json.loads(l) for l in f if l.strip()]
+        finally:
+            os.unlink(rname)
+
+        runs = [r for r in records if r["cmd"] == op]
+        if not runs or not runs[-1]["ok"]:
+            return None, "%s failed" % op
+        m = re.search(r"All blocks: .* peak (\d+) bytes", out)
+        peak = int(m.group(1)) if m else 0
+        return (runs[-1]["ns"], peak), None
+
+    def run(self, opList, distList, sizes, csvName=None):
+        csvFile = open(csvName, "w") if csvName else None
+        if csvFile:
+            csvFile.write("op,keys,n,ns,elements_per_s,peak_bytes\n")
+        print("%-9s %-9s %9s %12s %12s %10s" %
+              ("Op", "Keys", "N", "ms", "Melem/s", "Peak MiB"))
+        failures = 0
+        for op in opList:
+            for dist in distList:
+                timedOut = False
+                for n in sorted(sizes):
+                    # A larger queue would only take longer
+                    if timedOut:
+                        print("%-9s %-9s %9d  skipped" % (op, dist, n))
+                        continue
+                    res, err = self.runCase(op, dist, n)
+                    if err:
+                        print("%-9s %-9s %9d  FAILED: %s" % (op, dist, n, err))
+                        failures += 1
+                        timedOut = err.startswith("timed out")
+                        continue
+                    ns, peak = res
+                    rate = n / (ns / 1e9) if ns else 0
+                    print("%-9s %-9s %9d %12.3f %12.2f %10.1f" %
+                          (op, dist, n, ns / 1e6, rate / 1e6,
+                           peak / float(1 << 20)))
+                    sys.stdout.flush()
+                    if csvFile:
+                        csvFile.write("%s,%s,%d,%d,%.0f,%d\n" %
+                                      (op, dist, n, ns, rate, peak))
+        if csvFile:
+            csvFile.close()
+        return failures
+
+
+def usage(name):
+    print("Usage: %s [-h] [-p PROG] [-s SIZES] [-o OPS] [-d KEYS] [-m QUEUES]"
+          " [-k K] [-T SECS] [-c FILE]" % name)
+    print("  -h         Print this message")
+    print("  -p PROG    Program to benchmark (default ./qtest)")
+    print("  -s SIZES   Comma-separated queue sizes (default %s)" %
+          ",".join(str(s) for s in defaultSizes))
+    print("  -o OPS     Comma-separated operations among %s" % ",".join(ops))
+    print("  -d KEYS    Comma-separated key distributions among %s" %
+          ",".join(dists))
+    print("  -m QUEUES  Number of queues merged (default 8)")
+    print("  -k K       Group size of reverseK (default 16)")
+    print("  -T SECS    Give up on a case after SECS seconds (default 300), and\n"
+          "             skip larger sizes of that case")
+    print("  -c FILE    Also write the results to FILE as CSV")
+    sys.exit(0)
+
+
+def parseList(name, val, allowed):
+    items = val.split(",")
+    for item in items:
+        if item not in allowed:
+            print("Unknown %s '%s'" % (name, item))
+            sys.exit(1)
+    return items
+
+
+def run(name, args):
+    prog = ""
+    sizes = defaultSizes
+    opList = ops
+    distList = list(dists)
+    queues = 8
+    k = 16
+    timeout = 300
+    csvName = None
+
+    optlist, args = getopt.getopt(args, 'hp:s:o:d:m:k:T:c:')
+    for (opt, val) in optlist:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-p':
+            prog = val
+        elif opt == '-s':
+            sizes = [int(float(s)) for s in val.split(",")]
+        elif opt == '-o':
+            opList = parseList("operation", val, ops)
+        elif opt == '-d':
+            distList = parseList("key distribution", val, dists)
+        elif opt == '-m':
+            queues = int(val)
+        elif opt == '-k':
+            k = int(val)
+        elif opt == '-T':
+            timeout = int(val)
+        elif opt == '-c':
+            csvName = val
+    b = Bench(qtest=prog, queues=queues, k=k, timeout=timeout)
+    if b.run(opList, distList, sizes, csvName):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    run(sys.argv[0], sys.argv[1:])
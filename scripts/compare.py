@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+
+# Compare two per-command record files written by 'qtest --record' or the
+# 'record' command, and flag commands whose median duration grew by more
+# than a threshold.
+
+from __future__ import print_function
+import csv
+import getopt
+import json
+import sys
+
+
+def load(path):
+    """Return {command: ([ns, ...], [bytes, ...])} from a CSV or JSON file"""
+    with open(path) as f:
+        text = f.read()
+    if text.startswith('{'):
+        rows = [json.loads(line) for line in text.splitlines() if line]
+    else:
+        rows = list(csv.DictReader(text.splitlines()))
+    cmds = {}
+    for row in rows:
+        # Comments take no time worth comparing
+        if row['cmd'] == '#':
+            continue
+        ns, nbytes = cmds.setdefault(row['cmd'], ([], []))
+        ns.append(int(row['ns']))
+        nbytes.append(int(row['bytes']))
+    return cmds
+
+
+def median(values):
+    values = sorted(values)
+    mid = len(values) // 2
+    if len(values) % 2:
+        return values[mid]
+    return (values[mid - 1] + values[mid]) / 2
+
+
+def mean(values):
+    return sum(values) / len(values)
+
+
+def compare(base, new, threshold):
+    """Print a table of both runs, return the names of regressed commands"""
+    print("%-10s %8s %12s %12s %12s %8s %10s" %
+          ("Command", "Runs", "Base ns", "New ns", "New mean", "Change",
+           "New bytes"))
+    regressed = []
+    for cmd in sorted(set(base) | set(new)):
+        if cmd not in base or cmd not in new:
+            only = "base" if cmd in base else "new"
+            print("%-10s only in %s run" % (cmd, only))
+            continue
+        b, n = median(base[cmd][0]), median(new[cmd][0])
+        change = (n - b) * 100.0 / b if b else 0.0
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION"
+            regressed.append(cmd)
+        print("%-10s %8d %12.0f %12.0f %12.0f %+7.1f%% %10.1f%s" %
+              (cmd, len(new[cmd][0]), b, n, mean(new[cmd][0]), change,
+               mean(new[cmd][1]), flag))
+    return regressed
+
+
+def usage(name):
+    print("Usage: %s [-h] [-t PCT] BASE NEW" % name)
+    print("  -h      Print this message")
+    print("  -t PCT  Flag commands whose median time grew by more than "
+          "PCT percent (default 10)")
+    print("  BASE and NEW are CSV or JSON lines records of two runs")
+    sys.exit(0)
+
+
+def run(name, args):
+    threshold = 10.0
+
+    optlist, args = getopt.getopt(args, 'ht:', ['threshold='])
+    for (opt, val) in optlist:
+        if opt == '-h':
+            usage(name)
+        elif opt in ('-t', '--threshold'):
+            threshold = float(val)
+    if len(args) != 2:
+        usage(name)
+
+    regressed = compare(load(args[0]), load(args[1]), threshold)
+    if regressed:
+        print("Regressions beyond %.1f%%: %s" %
+              (threshold, " ".join(regressed)))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    run(sys.argv[0], sys.argv[1:])
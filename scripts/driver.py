@@ -4,6 +4,8 @@ from __future__ import print_function
 import subprocess
 import sys
 import getopt
+import time
+from concurrent.futures import ThreadPoolExecutor
 
 
 
@@ -17,6 +19,8 @@ class Tracer:
     autograde = False
     useValgrind = False
     colored = False
+    jobs = 1
+    timeout = None
 
     traceDict = {
         1: "trace-01-ops",
@@ -60,6 +64,10 @@ class Tracer:
 
     maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
 
+    # Traces whose verdict depends on timing, which the load of other traces
+    # would skew.  With -j they run alone once all others are done.
+    timingTraces = [17]
+
     RED = '\033[91m'
     GREEN = '\033[92m'
     WHITE = '\033[0m'
@@ -69,13 +77,17 @@ class Tracer:
                  verbLevel=0,
                  autograde=False,
                  useValgrind=False,
-                 colored=False):
+                 colored=False,
+                 jobs=1,
+                 timeout=None):
         if qtest != "":
             self.qtest = qtest
         self.verbLevel = verbLevel
         self.autograde = autograde
         self.useValgrind = useValgrind
         self.colored = colored
+        self.jobs = jobs
+        self.timeout = timeout
 
     def printInColor(self, text, color):
         if self.colored == False:
@@ -91,15 +103,97 @@ class Tracer:
         clist = self.command + ["-v", vname, "-f", fname]
 
         try:
-            retcode = subprocess.call(clist)
+            retcode = subprocess.call(clist, timeout=self.timeout)
+        except subprocess.TimeoutExpired:
+            self.printInColor("ERROR: Trace %s timed out after %d s" %
+                              (self.traceDict[tid], self.timeout), self.RED)
+            return False
         except Exception as e:
             self.printInColor("Call of '%s' failed: %s" % (" ".join(clist), e), self.RED)
             return False
         return retcode == 0
 
+    # Run a trace with its output captured, for running several at once.
+    # Returns the status ("ok", "fail" or "timeout"), seconds and output.
+    def runTraceCaptured(self, tid):
+        fname = "%s/%s.cmd" % (self.traceDirectory, self.traceDict[tid])
+        vname = "%d" % self.verbLevel
+        clist = self.command + ["-v", vname, "-f", fname]
+
+        start = time.time()
+        try:
+            proc = subprocess.run(clist,
+                                  stdout=subprocess.PIPE,
+                                  stderr=subprocess.STDOUT,
+                                  timeout=self.timeout)
+        except subprocess.TimeoutExpired as e:
+            output = e.output.decode(errors="replace") if e.output else ""
+            return "timeout", time.time() - start, output
+        except Exception as e:
+            return "fail", time.time() - start, \
+                "Call of '%s' failed: %s\n" % (" ".join(clist), e)
+        status = "ok" if proc.returncode == 0 else "fail"
+        return status, time.time() - start, \
+            proc.stdout.decode(errors="replace")
+
+    def showOutput(self, tid, result):
+        status, seconds, output = result
+        if self.verbLevel > 0:
+            print("+++ TESTING trace %s:" % self.traceDict[tid])
+        sys.stdout.write(output)
+        if status == "timeout":
+            self.printInColor("ERROR: Trace %s timed out after %d s" %
+                              (self.traceDict[tid], self.timeout), self.RED)
+        sys.stdout.flush()
+
+    # Run the traces in up to self.jobs qtest processes at a time, then the
+    # timing traces one by one.  Each trace's output is shown in trace order
+    # once it is complete, the timing traces last, followed by a table of the
+    # points and running time of every trace.
+    def runParallel(self, tidList):
+        pooled = [t for t in tidList if t not in self.timingTraces]
+        alone = [t for t in tidList if t in self.timingTraces]
+        # Start the slowest traces, the last ones, first so that they do not
+        # hold up the end of the run
+        order = sorted(pooled, reverse=True)
+        start = time.time()
+        results = {}
+        with ThreadPoolExecutor(max_workers=self.jobs) as pool:
+            futures = {t: pool.submit(self.runTraceCaptured, t) for t in order}
+            for t in pooled:
+                results[t] = futures[t].result()
+                self.showOutput(t, results[t])
+        for t in alone:
+            results[t] = self.runTraceCaptured(t)
+            self.showOutput(t, results[t])
+        elapsed = time.time() - start
+
+        print("---\tTrace\t\tPoints\tSeconds\tStatus")
+        scoreDict = {k: 0 for k in self.traceDict.keys()}
+        score = 0
+        maxscore = 0
+        total = 0.0
+        for t in tidList:
+            status, seconds, output = results[t]
+            maxval = self.maxScores[t]
+            tval = maxval if status == "ok" else 0
+            color = self.RED if tval < maxval else self.GREEN
+            self.printInColor("---\t%s\t%d/%d\t%.2f\t%s" %
+                              (self.traceDict[t], tval, maxval, seconds,
+                               status), color)
+            score += tval
+            maxscore += maxval
+            total += seconds
+            scoreDict[t] = tval
+        color = self.RED if score < maxscore else self.GREEN
+        self.printInColor("---\tTOTAL\t\t%d/%d\t%.2f" %
+                          (score, maxscore, elapsed), color)
+        print("---\t%d traces in %.2f s with %d jobs, %.2f s of trace time" %
+              (len(tidList), elapsed, self.jobs, total))
+        return score, maxscore, scoreDict
+
     def run(self, tid=0):
         scoreDict = {k: 0 for k in self.traceDict.keys()}
-        print("---\tTrace\t\tPoints")
         if tid == 0:
             tidList = self.traceDict.keys()
         else:
@@ -113,24 +207,28 @@ class Tracer:
             self.command = ['valgrind', self.qtest]
         else:
             self.command = [self.qtest]
-        for t in tidList:
-            tname = self.traceDict[t]
-            if self.verbLevel > 0:
-                print("+++ TESTING trace %s:" % tname)
-            ok = self.runTrace(t)
-            maxval = self.maxScores[t]
-            tval = maxval if ok else 0
-            if tval < maxval:
-                self.printInColor("---\t%s\t%d/%d" % (tname, tval, maxval), self.RED)
-            else:
-                self.printInColor("---\t%s\t%d/%d" % (tname, tval, maxval), self.GREEN)
-            score += tval
-            maxscore += maxval
-            scoreDict[t] = tval
-        if score < maxscore:
-            self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.RED)
+        if self.jobs > 1:
+            score, maxscore, scoreDict = self.runParallel(list(tidList))
         else:
-            self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.GREEN)
+            print("---\tTrace\t\tPoints")
+            for t in tidList:
+                tname = self.traceDict[t]
+                if self.verbLevel > 0:
+                    print("+++ TESTING trace %s:" % tname)
+                ok = self.runTrace(t)
+                maxval = self.maxScores[t]
+                tval = maxval if ok else 0
+                if tval < maxval:
+                    self.printInColor("---\t%s\t%d/%d" % (tname, tval, maxval), self.RED)
+                else:
+                    self.printInColor("---\t%s\t%d/%d" % (tname, tval, maxval), self.GREEN)
+                score += tval
+                maxscore += maxval
+                scoreDict[t] = tval
+            if score < maxscore:
+                self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.RED)
+            else:
+                self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.GREEN)
         if self.autograde:
             # Generate JSON string
             jstring = '{"scores": {'
@@ -145,13 +243,23 @@ class Tracer:
         if score < maxscore:
             sys.exit(1)
 
+# Per-trace limit when traces run in parallel, where a hung trace would
+# otherwise go unnoticed until all others are done
+parallelTimeout = 600
+
+
 def usage(name):
-    print("Usage: %s [-h] [-p PROG] [-t TID] [-v LEVEL] [--valgrind] [-c]" % name)
+    print("Usage: %s [-h] [-p PROG] [-t TID] [-v LEVEL] [--valgrind] [-c] "
+          "[-j N] [-T SECS]" % name)
     print("  -h        Print this message")
     print("  -p PROG   Program to test")
     print("  -t TID    Trace ID to test")
     print("  -v LEVEL  Set verbosity level (0-3)")
     print("  -c Enable colored text")
+    print("  -j N      Run up to N traces at once, each in its own qtest; "
+          "timing traces\n            still run alone")
+    print("  -T SECS   Fail a trace that runs longer than SECS seconds "
+          "(default %d with -j)" % parallelTimeout)
     sys.exit(0)
 
 
@@ -163,8 +271,10 @@ def run(name, args):
     autograde = False
     useValgrind = False
     colored = False
+    jobs = 1
+    timeout = None
 
-    optlist, args = getopt.getopt(args, 'hp:t:v:A:c', ['valgrind'])
+    optlist, args = getopt.getopt(args, 'hp:t:v:A:cj:T:', ['valgrind'])
     for (opt, val) in optlist:
         if opt == '-h':
             usage(name)
@@ -181,16 +291,24 @@ def run(name, args):
             useValgrind = True
         elif opt == '-c':
             colored = True
+        elif opt == '-j':
+            jobs = int(val)
+        elif opt == '-T':
+            timeout = int(val)
         else:
             print("Unrecognized option '%s'" % opt)
             usage(name)
     if not levelFixed and autograde:
         vlevel = 0
+    if timeout is None and jobs > 1:
+        timeout = parallelTimeout
     t = Tracer(qtest=prog,
                verbLevel=vlevel,
                autograde=autograde,
                useValgrind=useValgrind,
-               colored=colored)
+               colored=colored,
+               jobs=jobs,
+               timeout=timeout)
     t.run(tid)
 
 
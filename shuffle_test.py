@@ -4,13 +4,11 @@ import random
 from itertools import permutations
 import matplotlib.pyplot as plt
 import numpy as np
-from tqdm import tqdm
 
 # 測試 shuffle 次數
 test_count = 1000000
 input = "new\nit 1\nit 2\nit 3\nit 4\n"
-for i in tqdm(range(test_count)):
-    input += "shuffle\n"
+input += "repeat {} shuffle\n".format(test_count)
 input += "free\nquit\n"
 
 # 取得 stdout 的 shuffle 結果
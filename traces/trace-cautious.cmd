@@ -0,0 +1,22 @@
+# Test of 'q_delete_dup', 'q_ascend' and 'q_descend' freeing many elements
+# of a big queue within the time limit
+option fail 0
+option malloc 0
+new
+it bear 20000
+it gerbil 20000
+dedup
+size
+free
+new
+it gerbil 20000
+it bear
+ascend
+size
+free
+new
+it bear 20000
+it gerbil
+descend
+size
+free
@@ -0,0 +1,24 @@
+# Test of the kinds of strings 'ih' and 'it' generate for RAND, and of
+# inserting the names of those kinds literally
+option fail 0
+option malloc 0
+new
+it RAND 3 seq
+rh 000000000000
+rh 000000000001
+rh 000000000002
+it RAND 1000 few
+sort
+ih RAND 1000 prefix
+it RAND 1000 rand
+size
+free
+new
+it SEQ
+it few
+ih PREFIX 2
+rh PREFIX
+rh PREFIX
+rh SEQ
+rh few
+free
@@ -0,0 +1,33 @@
+# Test of 'q_merge' on more or fewer queues than the first queue has elements
+option fail 0
+option malloc 0
+new
+it dolphin
+new
+it bear
+it gerbil
+new
+it bear
+it meerkat
+it vulture
+merge
+rh bear
+rh bear
+rh dolphin
+rh gerbil
+rh meerkat
+rh vulture
+free
+new
+it bear
+it dolphin
+it gerbil
+it meerkat
+new
+it vulture
+merge
+rh bear
+rh dolphin
+rh gerbil
+rh meerkat
+rh vulture
@@ -0,0 +1,12 @@
+# Test of the stability check of 'q_sort' on a big queue with long runs of
+# duplicates
+option fail 0
+option malloc 0
+new
+it gerbil 30000
+it bear 30000
+sort
+rh bear
+rt gerbil
+size
+free
@@ -0,0 +1,11 @@
+# Test of 'option time': lifting the limit lets a queue operation run longer
+# than the default second
+option fail 0
+option malloc 0
+new
+it RAND 30000
+option time 0
+shuffle
+option time 1
+size
+free